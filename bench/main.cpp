@@ -0,0 +1,518 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstdlib>
+#include <new>
+#include "logger.h"
+#include "logger_sinks.h"
+
+std::atomic<size_t> allocation_count = 0;
+
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t size) noexcept {
+    std::free(ptr);
+}
+
+// measures the logger, not the terminal
+class NullSink : public LoggerSink {
+public:
+    void write(std::span<const std::string_view> records) override { }
+};
+
+struct BenchResult {
+    std::string name;
+    size_t ops = 0;
+    double ns_per_op = 0.0;
+    double p50_ns = 0.0;
+    double p99_ns = 0.0;
+    double p999_ns = 0.0;
+    double allocs_per_op = 0.0;
+    // name didn't match the filter, nothing was run
+    bool skipped = false;
+};
+
+using Clock = std::chrono::steady_clock;
+
+// set by --filter, benchmarks whose name doesn't contain it are not run
+std::string bench_filter;
+
+bool isSelected(const std::string& name) {
+    return name.find(bench_filter) != std::string::npos;
+}
+
+volatile int benchmark_sink = 0;
+int expensive_calls = 0;
+
+std::string expensiveString(int i) {
+    expensive_calls++;
+    return std::string(100, 'a' + i % 26);
+}
+
+// cost of the two clock reads around every timed operation
+double timerOverheadNs() {
+    static double overhead = -1.0;
+    if (overhead < 0.0) {
+        std::vector<double> samples(100000);
+        for (double& sample : samples) {
+            auto start = Clock::now();
+            auto end = Clock::now();
+            sample = std::chrono::duration<double, std::nano>(end - start).count();
+        }
+        std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+        overhead = samples[samples.size() / 2];
+    }
+    return overhead;
+}
+
+double percentile(std::vector<double>& samples, double p) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    size_t index = std::min(samples.size() - 1, (size_t)(p * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
+
+void fillPercentiles(BenchResult& result, std::vector<double>& samples) {
+    double overhead = timerOverheadNs();
+    for (double& sample : samples) {
+        sample = std::max(0.0, sample - overhead);
+    }
+    result.p50_ns = percentile(samples, 0.5);
+    result.p99_ns = percentile(samples, 0.99);
+    result.p999_ns = percentile(samples, 0.999);
+}
+
+// throughput pass without per-operation timing, then a latency pass timing every operation
+template<typename F>
+BenchResult runBench(const std::string& name, size_t ops, F func) {
+    BenchResult result;
+    result.name = name;
+    if (!isSelected(name)) {
+        result.skipped = true;
+        return result;
+    }
+    result.ops = ops;
+    for (size_t i = 0; i < std::min(ops / 10, (size_t)10000); i++) {
+        func((int)i);
+    }
+    size_t allocations_before = allocation_count;
+    auto start = Clock::now();
+    for (size_t i = 0; i < ops; i++) {
+        func((int)i);
+    }
+    auto end = Clock::now();
+    size_t allocations = allocation_count - allocations_before;
+    result.ns_per_op = std::chrono::duration<double, std::nano>(end - start).count() / ops;
+    result.allocs_per_op = (double)allocations / ops;
+    size_t latency_ops = std::min(ops, (size_t)200000);
+    std::vector<double> samples(latency_ops);
+    for (size_t i = 0; i < latency_ops; i++) {
+        auto op_start = Clock::now();
+        func((int)i);
+        auto op_end = Clock::now();
+        samples[i] = std::chrono::duration<double, std::nano>(op_end - op_start).count();
+    }
+    fillPercentiles(result, samples);
+    return result;
+}
+
+std::unique_ptr<Logger> makeLogger() {
+    std::unique_ptr<Logger> logger = std::make_unique<Logger>();
+    logger->addSink(std::make_shared<NullSink>());
+    return logger;
+}
+
+void writeBenches(std::vector<BenchResult>& results) {
+    const size_t ops = 1000000;
+    std::unique_ptr<Logger> bench_logger = makeLogger();
+    Logger& l = *bench_logger;
+    results.push_back(runBench("line_short_string", ops, [&](int i) {
+        l << "Short line\n";
+    }));
+    results.push_back(runBench("line_short_literal", ops, [&](int i) {
+        l << "Short line\n"_log;
+    }));
+    results.push_back(runBench("line_int", ops, [&](int i) {
+        l << i << "\n";
+    }));
+    results.push_back(runBench("line_double", ops, [&](int i) {
+        l << i * 0.5 << "\n";
+    }));
+    results.push_back(runBench("line_mixed", ops, [&](int i) {
+        l << "value " << i << " ratio " << i * 0.25 << " ok " << true << "\n";
+    }));
+    results.push_back(runBench("line_log", ops, [&](int i) {
+        l.log(LoggerLevel::Info, "value {} ratio {} ok {}", i, i * 0.25, true);
+    }));
+    results.push_back(runBench("line_record", ops, [&](int i) {
+        LOGGER_RECORD(l, "value {} ratio {}", i, i * 0.25);
+    }));
+    {
+        // debug lines below the logger level go only to the ring
+        std::unique_ptr<Logger> recorder_logger = makeLogger();
+        recorder_logger->setLevel(LoggerLevel::Info);
+        recorder_logger->setFlightRecorder(std::make_shared<LoggerFlightRecorder>(std::filesystem::temp_directory_path() / "logger_bench_recorder.log"));
+        results.push_back(runBench("line_recorder_only", ops, [&](int i) {
+            LOGGER_DEBUG(*recorder_logger) << "Line " << i << "\n";
+        }));
+    }
+}
+
+void numberBenches(std::vector<BenchResult>& results) {
+    const size_t ops = 1000000;
+    std::string buffer;
+    char number_buffer[LoggerFormat::MAX_NUMBER_LENGTH];
+    // std::to_string is what numbers used to be formatted with
+    results.push_back(runBench("format_int_to_string", ops, [&](int i) {
+        buffer.clear();
+        buffer += std::to_string(i * 997);
+    }));
+    results.push_back(runBench("format_int", ops, [&](int i) {
+        buffer.clear();
+        buffer += LoggerFormat::format(number_buffer, i * 997);
+    }));
+    results.push_back(runBench("format_double_to_string", ops, [&](int i) {
+        buffer.clear();
+        buffer += std::to_string(i * 0.001);
+    }));
+    results.push_back(runBench("format_double", ops, [&](int i) {
+        buffer.clear();
+        buffer += LoggerFormat::format(number_buffer, i * 0.001);
+    }));
+    std::unique_ptr<Logger> bench_logger = makeLogger();
+    Logger& l = *bench_logger;
+    results.push_back(runBench("line_telemetry", ops, [&](int i) {
+        l << "frame " << i << " x " << i * 0.125 << " y " << i * -0.5 << " dt " << 0.016f << " count " << (size_t)i << "\n";
+    }));
+}
+
+void disabledBenches(std::vector<BenchResult>& results) {
+    const size_t ops = 10000000;
+    std::unique_ptr<Logger> bench_logger = makeLogger();
+    Logger& l = *bench_logger;
+    results.push_back(runBench("loop_baseline", ops, [&](int i) {
+        benchmark_sink = i;
+    }));
+    l.setLevel(LoggerLevel::Info);
+    results.push_back(runBench("disabled_level", ops, [&](int i) {
+        benchmark_sink = i;
+        LOGGER_DEBUG(l) << expensiveString(i) << " " << i << "\n";
+    }));
+    l.setLevel(LoggerLevel::Trace);
+    {
+        LoggerDisableTag disable_tag(l, "disabled");
+        LoggerTag tag(l, "disabled");
+        results.push_back(runBench("disabled_tag", ops, [&](int i) {
+            benchmark_sink = i;
+            l << "value " << i << "\n";
+        }));
+        results.push_back(runBench("disabled_tag_lazy", ops, [&](int i) {
+            benchmark_sink = i;
+            l << [&] { return expensiveString(i); } << "\n";
+        }));
+        LoggerTagHandle handle = LoggerTagRegistry::registerTag("disabled");
+        results.push_back(runBench("disabled_tag_query", ops, [&](int i) {
+            benchmark_sink = i;
+            if (l.enabled(handle)) {
+                l << expensiveString(i) << "\n";
+            }
+        }));
+    }
+    results.push_back(runBench("suppressed_first_n", ops, [&](int i) {
+        benchmark_sink = i;
+        LOGGER_FIRST_N(l, 1) << "value " << i << "\n";
+    }));
+    results.push_back(runBench("suppressed_every_n", ops, [&](int i) {
+        benchmark_sink = i;
+        LOGGER_EVERY_N(l, 1000000000) << "value " << i << "\n";
+    }));
+    l.manualDeactivate();
+    results.push_back(runBench("disabled_manual", ops, [&](int i) {
+        benchmark_sink = i;
+        l << "value " << i << "\n";
+    }));
+    l.manualActivate();
+    if (expensive_calls != 0) {
+        std::cerr << "ERROR: arguments of disabled statements were evaluated" << std::endl;
+    }
+}
+
+void scopeBenches(std::vector<BenchResult>& results) {
+    const size_t ops = 1000000;
+    std::unique_ptr<Logger> bench_logger = makeLogger();
+    Logger& l = *bench_logger;
+    LoggerTagHandle handle = LoggerTagRegistry::registerTag("scope");
+    results.push_back(runBench("scope_tag_handle", ops, [&](int i) {
+        LoggerTag tag(l, handle);
+    }));
+    results.push_back(runBench("scope_tag_string", ops, [&](int i) {
+        LoggerTag tag(l, "scope");
+    }));
+    results.push_back(runBench("scope_indent", ops, [&](int i) {
+        LoggerIndent indent(l);
+    }));
+    {
+        LoggerIndent indent(l, 16);
+        results.push_back(runBench("line_indent_16", ops, [&](int i) {
+            l << "Indented line\n";
+        }));
+    }
+}
+
+void timestampBenches(std::vector<BenchResult>& results) {
+    const size_t ops = 1000000;
+    LoggerTimestamp timestamp;
+    std::string buffer;
+    results.push_back(runBench("timestamp_now", ops, [&](int i) {
+        benchmark_sink = (int)timestamp.now();
+    }));
+    results.push_back(runBench("timestamp_write", ops, [&](int i) {
+        buffer.clear();
+        timestamp.write(buffer, timestamp.now());
+    }));
+    timestamp.setPrecision(LoggerTimePrecision::Microseconds);
+    results.push_back(runBench("timestamp_write_us", ops, [&](int i) {
+        buffer.clear();
+        timestamp.write(buffer, timestamp.now());
+    }));
+}
+
+// autoflush is on, so every line reaches the sink
+void sinkBenches(std::vector<BenchResult>& results) {
+    const size_t ops = 200000;
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "logger_bench_sinks";
+    std::filesystem::create_directories(dir);
+    {
+        Logger l;
+        l.addSink(std::make_shared<LoggerFileSink>(dir / "file.log", 0));
+        results.push_back(runBench("sink_file_unbuffered", ops, [&](int i) {
+            l << "Line " << i << "\n";
+        }));
+    }
+    {
+        Logger l;
+        l.addSink(std::make_shared<LoggerFileSink>(dir / "buffered.log"));
+        results.push_back(runBench("sink_file_buffered", ops, [&](int i) {
+            l << "Line " << i << "\n";
+        }));
+    }
+    {
+        Logger l;
+        l.addSink(std::make_shared<LoggerMappedFileSink>(dir / "mapped.log"));
+        results.push_back(runBench("sink_mapped", ops, [&](int i) {
+            l << "Line " << i << "\n";
+        }));
+    }
+    {
+        Logger l;
+        auto compressed_sink = std::make_shared<LoggerCompressedSink>(std::make_shared<LoggerFileSink>(dir / "compressed.log"));
+        l.addSink(compressed_sink);
+        results.push_back(runBench("sink_compressed", ops, [&](int i) {
+            LoggerIndent indent(l);
+            l << "Line " << i << "\n";
+        }));
+        l.flush();
+    }
+    {
+        // slow file sink and a fast one, each on its own worker
+        Logger l;
+        l.addSink(std::make_shared<LoggerFileSink>(dir / "staged.log", 0), LoggerAsyncOptions());
+        l.addSink(std::make_shared<NullSink>(), LoggerAsyncOptions());
+        results.push_back(runBench("sink_stages", ops, [&](int i) {
+            l << "Line " << i << "\n";
+        }));
+        l.flush();
+    }
+    {
+        // per line callback copies every line into a std::string
+        Logger l;
+        size_t total = 0;
+        l.OnLineWrite = [&](std::string line) {
+            total += line.size();
+        };
+        results.push_back(runBench("callback_line", ops, [&](int i) {
+            l << "Line " << i << "\n";
+        }));
+    }
+    {
+        Logger l;
+        l.setAutoFlush(false);
+        size_t total = 0;
+        l.OnBatchWrite = [&](std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos) {
+            for (std::string_view record : records) {
+                total += record.size();
+            }
+        };
+        results.push_back(runBench("callback_batch", ops, [&](int i) {
+            l << "Line " << i << "\n";
+        }));
+    }
+    std::filesystem::remove_all(dir);
+}
+
+void largeTextBenches(std::vector<BenchResult>& results) {
+    const size_t ops = 1000000;
+    {
+        std::unique_ptr<Logger> bench_logger = makeLogger();
+        Logger& l = *bench_logger;
+        LoggerLargeText large_text(l);
+        results.push_back(runBench("large_text_line", ops, [&](int i) {
+            l << "Text line " << i << "\n";
+        }));
+    }
+    // whole snapshot per op, unbuffered file sink gets it as one batch and writes it with writev
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "logger_bench_large_text";
+    std::filesystem::create_directories(dir);
+    {
+        Logger dump_logger;
+        dump_logger.addSink(std::make_shared<LoggerFileSink>(dir / "dump.log", 0));
+        results.push_back(runBench("large_text_dump_100k", 20, [&](int i) {
+            LoggerLargeText dump_text(dump_logger);
+            for (int line = 0; line < 100000; line++) {
+                dump_logger << "Snapshot line " << line << "\n";
+            }
+        }));
+    }
+    std::filesystem::remove_all(dir);
+}
+
+std::string threadBenchName(size_t thread_count, size_t batch_lines) {
+    return (batch_lines > 0 ? "threads_batch_" : "threads_") + std::to_string(thread_count);
+}
+
+BenchResult threadBench(size_t thread_count, size_t batch_lines) {
+    const size_t ops_per_thread = 200000;
+    std::unique_ptr<Logger> bench_logger = makeLogger();
+    Logger& l = *bench_logger;
+    LoggerThreadSafeOptions options;
+    options.batch_lines = batch_lines;
+    l.enableThreadSafe(options);
+    std::vector<std::vector<double>> thread_samples(thread_count);
+    std::vector<std::thread> threads;
+    size_t allocations_before = allocation_count;
+    auto start = Clock::now();
+    for (size_t t = 0; t < thread_count; t++) {
+        threads.push_back(std::thread([&, t]() {
+            std::vector<double>& samples = thread_samples[t];
+            samples.resize(ops_per_thread);
+            for (size_t i = 0; i < ops_per_thread; i++) {
+                auto op_start = Clock::now();
+                l << "thread " << (int)t << " line " << (int)i << "\n";
+                auto op_end = Clock::now();
+                samples[i] = std::chrono::duration<double, std::nano>(op_end - op_start).count();
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    auto end = Clock::now();
+    l.flush();
+    std::vector<double> samples;
+    for (const std::vector<double>& s : thread_samples) {
+        samples.insert(samples.end(), s.begin(), s.end());
+    }
+    BenchResult result;
+    result.name = threadBenchName(thread_count, batch_lines);
+    result.ops = ops_per_thread * thread_count;
+    // aggregate throughput, lower is better
+    result.ns_per_op = std::chrono::duration<double, std::nano>(end - start).count() / result.ops;
+    result.allocs_per_op = (double)(allocation_count - allocations_before) / result.ops;
+    fillPercentiles(result, samples);
+    return result;
+}
+
+void threadBenches(std::vector<BenchResult>& results) {
+    for (size_t batch_lines : { 0, 64 }) {
+        for (size_t thread_count : { 1, 2, 4, 8, 16 }) {
+            if (isSelected(threadBenchName(thread_count, batch_lines))) {
+                results.push_back(threadBench(thread_count, batch_lines));
+            }
+        }
+    }
+}
+
+void printTable(const std::vector<BenchResult>& results) {
+    std::cout << std::left << std::setw(24) << "name"
+        << std::right << std::setw(10) << "ops"
+        << std::setw(12) << "ns/op"
+        << std::setw(12) << "p50 ns"
+        << std::setw(12) << "p99 ns"
+        << std::setw(12) << "p99.9 ns"
+        << std::setw(12) << "allocs/op" << "\n";
+    std::cout << std::fixed << std::setprecision(2);
+    for (const BenchResult& result : results) {
+        std::cout << std::left << std::setw(24) << result.name
+            << std::right << std::setw(10) << result.ops
+            << std::setw(12) << result.ns_per_op
+            << std::setw(12) << result.p50_ns
+            << std::setw(12) << result.p99_ns
+            << std::setw(12) << result.p999_ns
+            << std::setw(12) << result.allocs_per_op << "\n";
+    }
+}
+
+// stable format for comparing versions, columns are only ever added at the end
+void printCsv(const std::vector<BenchResult>& results) {
+    std::cout << "name,ops,ns_per_op,p50_ns,p99_ns,p999_ns,allocs_per_op\n";
+    std::cout << std::fixed << std::setprecision(3);
+    for (const BenchResult& result : results) {
+        std::cout << result.name << ","
+            << result.ops << ","
+            << result.ns_per_op << ","
+            << result.p50_ns << ","
+            << result.p99_ns << ","
+            << result.p999_ns << ","
+            << result.allocs_per_op << "\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    bool csv = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--csv") {
+            csv = true;
+        } else if (arg.rfind("--filter=", 0) == 0) {
+            bench_filter = arg.substr(9);
+        } else {
+            std::cerr << "Usage: logger-bench [--csv] [--filter=<name part>]" << std::endl;
+            return 1;
+        }
+    }
+    Logger::disableStdWrite();
+    std::vector<BenchResult> results;
+    writeBenches(results);
+    numberBenches(results);
+    disabledBenches(results);
+    scopeBenches(results);
+    timestampBenches(results);
+    largeTextBenches(results);
+    sinkBenches(results);
+    threadBenches(results);
+    std::erase_if(results, [](const BenchResult& result) { return result.skipped; });
+    if (csv) {
+        printCsv(results);
+    } else {
+        printTable(results);
+    }
+    return 0;
+}
@@ -0,0 +1,52 @@
+#include <iostream>
+#include <fstream>
+#include <csignal>
+#include <thread>
+#include "logger_shm.h"
+
+static volatile std::sig_atomic_t stop_requested = 0;
+
+static void requestStop(int signal) {
+    stop_requested = 1;
+}
+
+int main(int argc, char* argv[]) {
+    bool once = false;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--once") {
+            once = true;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.empty() || args.size() > 2) {
+        std::cerr << "Usage: logger-collect <segment prefix> [output file] [--once]" << std::endl;
+        return 1;
+    }
+    std::ofstream output_file;
+    if (args.size() == 2) {
+        output_file.open(args[1], std::ios::binary | std::ios::app);
+        if (!output_file.is_open()) {
+            std::cerr << "Cannot open " << args[1] << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& output = args.size() == 2 ? output_file : std::cout;
+    LoggerShmCollector collector(args[0]);
+    if (once) {
+        collector.collect(output, true);
+        return 0;
+    }
+    std::signal(SIGINT, requestStop);
+    std::signal(SIGTERM, requestStop);
+    while (!stop_requested) {
+        if (collector.collect(output) == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    // held back records are written on exit
+    collector.collect(output, true);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#include <iostream>
+#include <fstream>
+#include "logger_compress.h"
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: logger-decompress <compressed log> [output file]" << std::endl;
+        return 1;
+    }
+    std::ifstream input(argv[1], std::ios::binary);
+    if (!input.is_open()) {
+        std::cerr << "Cannot open " << argv[1] << std::endl;
+        return 1;
+    }
+    std::ofstream output_file;
+    if (argc == 3) {
+        output_file.open(argv[2], std::ios::binary);
+        if (!output_file.is_open()) {
+            std::cerr << "Cannot open " << argv[2] << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& output = argc == 3 ? output_file : std::cout;
+    LoggerDecompressor decompressor;
+    if (!decompressor.decompress(input, output)) {
+        std::cerr << argv[1] << ": " << decompressor.getError() << std::endl;
+        return 1;
+    }
+    return 0;
+}
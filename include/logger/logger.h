@@ -1,12 +1,118 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <vector>
 #include <functional>
 #include <stack>
-#include <set>
+#include <unordered_map>
+#include <deque>
+#include <array>
 #include <filesystem>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <span>
+#include <algorithm>
+#include <type_traits>
+#include <concepts>
+#include <bit>
+
+#define LOGGER_LEVEL_TRACE 0
+#define LOGGER_LEVEL_DEBUG 1
+#define LOGGER_LEVEL_INFO 2
+#define LOGGER_LEVEL_WARN 3
+#define LOGGER_LEVEL_ERROR 4
+#define LOGGER_LEVEL_OFF 5
+
+// Logger::getStats counters, compiled out unless enabled
+#ifndef LOGGER_STATS
+#define LOGGER_STATS 0
+#endif
+
+// statements below this level are compiled out
+#ifndef LOGGER_MIN_LEVEL
+#define LOGGER_MIN_LEVEL LOGGER_LEVEL_TRACE
+#endif
+
+// arguments are evaluated only if the level is enabled:
+// LOGGER_DEBUG(logger) << expensiveDump() << "\n";
+#define LOGGER_LOG(logger_object, level) \
+	if constexpr ((int)(level) < LOGGER_MIN_LEVEL) { } \
+	else if (!(logger_object).isLevelEnabled(level)) { } \
+	else if (LoggerLineLevel logger_line_level(logger_object, level); false) { } \
+	else (logger_object)
+
+#define LOGGER_TRACE(logger_object) LOGGER_LOG(logger_object, LoggerLevel::Trace)
+#define LOGGER_DEBUG(logger_object) LOGGER_LOG(logger_object, LoggerLevel::Debug)
+#define LOGGER_INFO(logger_object) LOGGER_LOG(logger_object, LoggerLevel::Info)
+#define LOGGER_WARN(logger_object) LOGGER_LOG(logger_object, LoggerLevel::Warn)
+#define LOGGER_ERROR(logger_object) LOGGER_LOG(logger_object, LoggerLevel::Error)
+
+// rate limiting per call site, arguments of suppressed statements are not evaluated:
+// LOGGER_EVERY_N(logger, 100) << "x=" << x << "\n";
+// suppressed statements are counted and reported by Logger::writeSuppressedSummary
+#define LOGGER_RATE_LIMIT(logger_object, check) \
+	if (static LoggerCallSite logger_call_site(__FILE__, __LINE__); !logger_call_site.check) { } \
+	else (logger_object)
+
+// 1st, N+1th, 2N+1th, ... occurrence
+#define LOGGER_EVERY_N(logger_object, n) LOGGER_RATE_LIMIT(logger_object, everyN(logger_object, n))
+// first N occurrences
+#define LOGGER_FIRST_N(logger_object, n) LOGGER_RATE_LIMIT(logger_object, firstN(logger_object, n))
+// at most N occurrences in each second
+#define LOGGER_PER_SECOND(logger_object, n) LOGGER_RATE_LIMIT(logger_object, perSecond(logger_object, n))
+
+// writes a whole line, each {} is replaced with the next argument:
+// LOGGER_RECORD(logger, "x={} y={}", x, y);
+// in binary mode only the format id and raw argument bytes are written
+#define LOGGER_RECORD(logger_object, format, ...) \
+	do { \
+		static const uint32_t logger_format_id = LoggerFormatRegistry::registerFormat(format); \
+		(logger_object).record(logger_format_id, format __VA_OPT__(,) __VA_ARGS__); \
+	} while (false)
+
+class Logger;
+
+// state of a rate limited statement, lives in static storage of the call site
+class LoggerCallSite {
+public:
+	LoggerCallSite(const char* file, int line);
+	bool everyN(Logger& logger, uint64_t n);
+	bool firstN(Logger& logger, uint64_t n);
+	bool perSecond(Logger& logger, uint64_t n);
+	const char* getFile() const;
+	int getLine() const;
+	// suppressed since the last call
+	uint64_t takeSuppressed();
+	// id of the logger that suppressed the statement last, its summary reports the site
+	uint64_t getLoggerId() const;
+	// all call sites that were reached at least once, newest first
+	static LoggerCallSite* getFirst();
+	LoggerCallSite* getNext() const;
+
+private:
+	const char* file;
+	int line;
+	std::atomic<uint64_t> count = 0;
+	std::atomic<uint64_t> suppressed = 0;
+	std::atomic<int64_t> window = 0;
+	std::atomic<uint64_t> logger_id = 0;
+	LoggerCallSite* next = nullptr;
+	inline static std::atomic<LoggerCallSite*> first = nullptr;
+	// summary interval is checked once per this many suppressed statements
+	static const uint64_t SUMMARY_CHECK_PERIOD = 1024;
+
+	bool pass(Logger& logger);
+	bool suppress(Logger& logger);
+	// steady seconds from a clock that is only updated on timer ticks, but is cheap to read
+	static int64_t coarseSecond();
+};
 
 // if a method can modify logger object
 // in a way unrelated to logging,
@@ -14,13 +120,618 @@
 
 struct LoggerFlush { };
 
+enum class LoggerLevel {
+	Trace = LOGGER_LEVEL_TRACE,
+	Debug = LOGGER_LEVEL_DEBUG,
+	Info = LOGGER_LEVEL_INFO,
+	Warn = LOGGER_LEVEL_WARN,
+	Error = LOGGER_LEVEL_ERROR,
+	Off = LOGGER_LEVEL_OFF,
+};
+
+// level of the lines written while it exists, set by LOGGER_LOG,
+// lines below Logger::getLevel go only to the flight recorder,
+// does nothing without a flight recorder, then no such lines get through
+class LoggerLineLevel {
+public:
+	LoggerLineLevel(Logger& logger, LoggerLevel level);
+	~LoggerLineLevel();
+
+private:
+	Logger* logger = nullptr;
+	LoggerLevel previous;
+};
+
+enum class LoggerOverflowPolicy {
+	Block,
+	DropNewest,
+	DropOldest,
+};
+
+struct LoggerRecordInfo;
+
+// receives batches of finished records,
+// a record is a line or a part of a line written with LoggerFlush,
+// records of binary mode go only to the binary file
+class LoggerSink {
+public:
+	virtual ~LoggerSink() = default;
+	virtual void write(std::span<const std::string_view> records) = 0;
+	// the logger calls this one, infos are the metadata of records with the same index,
+	// sinks that don't need them keep the default, which drops them
+	virtual void write(std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos);
+	virtual void flush() { }
+};
+
+struct LoggerAsyncOptions {
+	size_t capacity = 1024;
+	LoggerOverflowPolicy overflow_policy = LoggerOverflowPolicy::Block;
+};
+
+// takes batches of records from the logger and passes them
+// to the output on a separate thread
+class LoggerAsyncWriter {
+public:
+	using Output = std::function<void(std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos)>;
+
+	LoggerAsyncWriter(const LoggerAsyncOptions& options, Output output, std::function<void()> flush_output);
+	~LoggerAsyncWriter();
+	void push(std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos);
+	void drain();
+	size_t getDroppedCount() const;
+
+private:
+	struct Batch {
+		std::string text;
+		std::vector<size_t> record_sizes;
+		std::vector<LoggerRecordInfo> infos;
+	};
+	LoggerAsyncOptions options;
+	Output output;
+	std::function<void()> flush_output;
+	// bounded ring of reusable batches
+	std::vector<Batch> queue;
+	size_t queue_head = 0;
+	size_t queue_size = 0;
+	bool writing = false;
+	bool stopping = false;
+	std::atomic<size_t> dropped_count = 0;
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::condition_variable idle;
+	std::thread thread;
+
+	void run();
+};
+
+// records of a flush copied once and shared by all sink stages,
+// returned to the pool when the last stage is done with it
+struct LoggerSharedBatch {
+	std::string text;
+	// views into text
+	std::vector<std::string_view> records;
+	std::vector<LoggerRecordInfo> infos;
+	// stages that haven't released it yet
+	std::atomic<size_t> holders = 0;
+};
+
+// shared batches are returned by their last holder, so taking one
+// doesn't depend on how many are still queued
+class LoggerSharedBatchPool {
+public:
+	// empty batch, goes back to the pool after the given number of releases
+	LoggerSharedBatch* take(size_t holders);
+	void release(LoggerSharedBatch* batch);
+
+private:
+	std::mutex mutex;
+	std::vector<std::unique_ptr<LoggerSharedBatch>> batches;
+	std::vector<LoggerSharedBatch*> free_batches;
+};
+
+// worker thread of a single sink added with Logger::addSink(sink, options),
+// takes shared batches in order, so a slow sink doesn't hold up the others
+class LoggerSinkStage {
+public:
+	LoggerSinkStage(std::shared_ptr<LoggerSink> sink, const LoggerAsyncOptions& options, LoggerSharedBatchPool& pool);
+	~LoggerSinkStage();
+	// batch is released to the pool once written or dropped
+	void push(LoggerSharedBatch* batch);
+	// waits for queued batches and flushes the sink
+	void drain();
+	size_t getDroppedCount() const;
+	const std::shared_ptr<LoggerSink>& getSink() const;
+
+private:
+	std::shared_ptr<LoggerSink> sink;
+	LoggerAsyncOptions options;
+	LoggerSharedBatchPool& pool;
+	std::vector<LoggerSharedBatch*> queue;
+	size_t queue_head = 0;
+	size_t queue_size = 0;
+	bool writing = false;
+	bool stopping = false;
+	std::atomic<size_t> dropped_count = 0;
+	std::mutex mutex;
+	std::condition_variable not_empty;
+	std::condition_variable not_full;
+	std::condition_variable idle;
+	std::thread thread;
+
+	void run();
+};
+
+struct LoggerThreadSafeOptions {
+	size_t ring_capacity = 4096;
+	// lines of each thread are published in batches of this size and
+	// merged by time when the ring is drained, 0 publishes every line
+	size_t batch_lines = 0;
+	// unfinished batch is published with the next line after this time,
+	// or by flush() and lines of other threads if its thread stays idle
+	std::chrono::microseconds batch_interval = std::chrono::milliseconds(100);
+	// lines start with [T1], [T2], ... in the order threads first wrote to the logger
+	bool thread_prefix = false;
+};
+
+// lock-free bounded queue, any number of threads can push,
+// only one thread at a time can pop
+class LoggerRingBuffer {
+public:
+	LoggerRingBuffer(size_t capacity);
+	// entry is head followed by text
+	bool tryPush(std::string_view head, std::string_view text);
+	// oldest record or nullptr, stays valid until pop
+	const std::string* peek() const;
+	void pop();
+	bool empty() const;
+
+private:
+	struct Slot {
+		std::atomic<size_t> sequence;
+		std::string text;
+	};
+	std::unique_ptr<Slot[]> slots;
+	size_t mask = 0;
+	alignas(64) std::atomic<size_t> enqueue_pos = 0;
+	alignas(64) std::atomic<size_t> dequeue_pos = 0;
+};
+
+enum class LoggerClock {
+	// local time of day
+	Wall,
+	// time elapsed since the logger was created
+	Monotonic,
+};
+
+enum class LoggerTimePrecision {
+	Seconds,
+	Milliseconds,
+	Microseconds,
+};
+
+// formats "[hh:mm:ss] " prefixes, the hh:mm:ss part is reformatted only when the second changes,
+// cached text is guarded by a seqlock so any number of threads can read it without locking
+class LoggerTimestamp {
+public:
+	LoggerTimestamp();
+	LoggerClock getClock() const;
+	void setClock(LoggerClock clock);
+	LoggerTimePrecision getPrecision() const;
+	void setPrecision(LoggerTimePrecision precision);
+	// microseconds
+	int64_t now() const;
+	void write(std::string& buffer, int64_t time);
+
+private:
+	static const size_t TEXT_SIZE = 16;
+	LoggerClock clock = LoggerClock::Wall;
+	LoggerTimePrecision precision = LoggerTimePrecision::Seconds;
+	std::chrono::steady_clock::time_point start;
+	alignas(64) std::atomic<uint64_t> sequence = 0;
+	std::atomic<int64_t> cached_second = INT64_MIN;
+	std::atomic<uint64_t> cached_text[TEXT_SIZE / sizeof(uint64_t)] = { };
+
+	bool readCache(int64_t second, char* text) const;
+	bool writeCache(int64_t second, const char* text);
+	void formatSecond(int64_t second, char* text) const;
+};
+
+// text conversions shared by the logger and logger-decode
+enum class LoggerFloatFormat : uint8_t {
+	Shortest, // shortest text that reads back to the same value
+	Fixed,
+	Scientific,
+};
+
+struct LoggerNumberFormat {
+	LoggerFloatFormat float_format = LoggerFloatFormat::Shortest;
+	// digits after the point, not used by Shortest
+	uint8_t precision = 6;
+	// integers are written in hex without a prefix
+	bool hex = false;
+};
+
+class LoggerFormat {
+public:
+	// enough for any number with the maximum precision
+	static const size_t MAX_NUMBER_LENGTH = 512;
+	static const uint8_t MAX_PRECISION = 64;
+
+	// formats value into buffer of MAX_NUMBER_LENGTH chars without allocating
+	static std::string_view format(char* buffer, int value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static std::string_view format(char* buffer, unsigned int value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static std::string_view format(char* buffer, size_t value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static std::string_view format(char* buffer, ptrdiff_t value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static std::string_view format(char* buffer, float value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static std::string_view format(char* buffer, double value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static void append(std::string& out, int value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static void append(std::string& out, unsigned int value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static void append(std::string& out, size_t value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static void append(std::string& out, ptrdiff_t value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static void append(std::string& out, float value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static void append(std::string& out, double value, const LoggerNumberFormat& options = LoggerNumberFormat());
+	static void append(std::string& out, bool value);
+	// appends text up to the next {} and removes it from format,
+	// returns false if there are no placeholders left
+	static bool appendLiteral(std::string& out, std::string_view& format);
+};
+
+// assigns ids to LOGGER_RECORD format strings, each call site registers once
+class LoggerFormatRegistry {
+public:
+	static uint32_t registerFormat(const char* format);
+
+private:
+	std::mutex mutex;
+	std::unordered_map<const char*, uint32_t> ids;
+
+	static LoggerFormatRegistry& instance();
+};
+
+// string literal as a template argument, trailing newline is cut off in format
+template<size_t N>
+struct LoggerFixedString {
+	char text[N] = { };
+	char format[N] = { };
+
+	consteval LoggerFixedString(const char (&value)[N]) {
+		for (size_t i = 0; i < N; i++) {
+			text[i] = value[i];
+			format[i] = value[i];
+		}
+		if (N > 1 && format[N - 2] == '\n') {
+			format[N - 2] = '\0';
+		}
+	}
+	consteval size_t count(char c) const {
+		size_t result = 0;
+		for (size_t i = 0; i + 1 < N; i++) {
+			result += text[i] == c;
+		}
+		return result;
+	}
+};
+
+// "text\n"_log is written with everything known at compile time:
+// newlines are not searched for, a line is copied with a single append,
+// in binary mode a single line is written as a record with a format id and no arguments
+template<LoggerFixedString S>
+struct LoggerLiteral {
+	static constexpr std::string_view text = std::string_view(S.text, sizeof(S.text) - 1);
+	static constexpr size_t newline_count = S.count('\n');
+	// one line ending with a newline
+	static constexpr bool is_line = newline_count == 1 && text.ends_with('\n');
+	// braces would be taken for placeholders by the decoder
+	static constexpr bool is_record = is_line && S.count('{') == 0 && S.count('}') == 0;
+
+	static uint32_t id() {
+		static const uint32_t value = LoggerFormatRegistry::registerFormat(S.format);
+		return value;
+	}
+};
+
+template<LoggerFixedString S>
+consteval LoggerLiteral<S> operator""_log() {
+	return { };
+}
+
+// specialize to write your own types with Logger::log and operator<<
+// without going through std::string:
+// template<>
+// struct LoggerFormatter<Vec2> {
+//     static void format(std::string& out, const Vec2& value) { ... }
+// };
+template<typename T>
+struct LoggerFormatter { };
+
+template<typename T>
+concept LoggerCustomFormattable = requires(std::string& out, const T& value) {
+	LoggerFormatter<T>::format(out, value);
+};
+
+// not defined, calling it while checking a format string fails compilation
+void loggerFormatPlaceholderCountMismatch();
+
+// format string for Logger::log, number of {} is checked against
+// the number of arguments at compile time
+template<typename... Args>
+class LoggerFormatString {
+public:
+	consteval LoggerFormatString(const char* format) : format(format) {
+		if (countPlaceholders(this->format) != sizeof...(Args)) {
+			loggerFormatPlaceholderCountMismatch();
+		}
+	}
+	std::string_view get() const {
+		return format;
+	}
+
+private:
+	std::string_view format;
+
+	static consteval size_t countPlaceholders(std::string_view format) {
+		size_t count = 0;
+		for (size_t pos = format.find("{}"); pos != std::string_view::npos; pos = format.find("{}", pos + 2)) {
+			count++;
+		}
+		return count;
+	}
+};
+
+// binary log layout, all integers are in native byte order:
+// header: LOGGER_BINARY_MAGIC, u8 write_time, u8 clock, u8 precision,
+//     u8 float format, u8 float precision, u8 hex, u32 indent unit length, indent unit, u32 indent max depth
+// Format: u32 format id, u32 length, format string
+// Line: u8 flags, i64 time, u32 tag, u32 indent, u32 length, text
+// Record: u8 flags, i64 time, u32 tag, u32 indent, u32 format id, u8 arg count, args
+// each arg is a LoggerBinaryArg followed by the raw value, strings are u32 length and bytes
+#define LOGGER_BINARY_MAGIC "CPPLOGB3"
+
+enum class LoggerBinaryRecord : uint8_t {
+	Format = 'F',
+	Line = 'L',
+	Record = 'R',
+};
+
+enum class LoggerBinaryArg : uint8_t {
+	Int,
+	UnsignedInt,
+	Sizet,
+	Ptrdifft,
+	Float,
+	Double,
+	Bool,
+	String,
+};
+
+// line ends with a newline
+const uint8_t LOGGER_BINARY_NEWLINE = 1;
+// line continues a previous record, no time and indentation prefix
+const uint8_t LOGGER_BINARY_CONTINUATION = 2;
+const uint32_t LOGGER_BINARY_NO_TAG = 0xFFFFFFFF;
+
+struct LoggerTagHandle {
+	uint32_t id = 0;
+};
+
+// metadata of a record, passed to Logger::OnBatchWrite
+struct LoggerRecordInfo {
+	// microseconds, see LoggerTimestamp::now
+	int64_t time = 0;
+	// innermost tag, id is LOGGER_BINARY_NO_TAG outside of all tags
+	LoggerTagHandle tag = { LOGGER_BINARY_NO_TAG };
+	uint32_t indent_level = 0;
+	// 0 outside of thread-safe mode, otherwise 1, 2, ... in the order threads first wrote
+	uint32_t thread_index = 0;
+};
+
+// interns tag names into small integer ids shared by all loggers,
+// register tags once and pass handles to LoggerTag to avoid string lookups
+class LoggerTagRegistry {
+public:
+	static const size_t MAX_TAGS = 1024;
+	// tags registered after the first MAX_TAGS all get this id and share its flags
+	static const uint32_t OVERFLOW_TAG = MAX_TAGS;
+
+	static LoggerTagHandle registerTag(const std::string& name);
+	// doesn't register the name, returns false if it's not registered
+	static bool findTag(const std::string& name, LoggerTagHandle& tag);
+	static const std::string& getName(LoggerTagHandle tag);
+
+private:
+	std::mutex mutex;
+	std::unordered_map<std::string, uint32_t> ids;
+	// deque keeps references stable
+	std::deque<std::string> names;
+
+	static LoggerTagRegistry& instance();
+};
+
+struct LoggerIndentStyle {
+	std::string glyph = "|";
+	// glyph is padded with spaces up to this width
+	size_t width = 4;
+	// deeper levels are written as this one, 0 for no limit
+	size_t max_depth = 0;
+};
+
+// prefixes for all indent levels are slices of one prebuilt buffer,
+// writing a prefix is a single append
+class LoggerIndentTable {
+public:
+	static const size_t TABLE_DEPTH = 64;
+
+	LoggerIndentTable(const LoggerIndentStyle& style = LoggerIndentStyle());
+	const LoggerIndentStyle& getStyle() const;
+	// glyph padded to the width, prefix of a single level
+	std::string_view getUnit() const;
+	void append(std::string& out, ptrdiff_t depth) const;
+
+private:
+	LoggerIndentStyle style;
+	size_t unit_size = 0;
+	std::string table;
+};
+
+// stores records in fixed-size pages, a record is never split between pages
+// and appending never moves existing records, cleared pages are kept for reuse
+class LoggerPageBuffer {
+public:
+	LoggerPageBuffer(size_t page_size = 64 * 1024);
+	// returned view stays valid until clear
+	std::string_view append(std::string_view record);
+	size_t size() const;
+	bool empty() const;
+	void clear();
+	std::string str() const;
+	size_t getPageCount() const;
+
+private:
+	struct Page {
+		std::unique_ptr<char[]> data;
+		size_t capacity = 0;
+		size_t size = 0;
+	};
+	size_t page_size = 0;
+	size_t total_size = 0;
+	std::vector<Page> pages;
+	std::vector<Page> free_pages;
+};
+
+// log-linear buckets of durations in nanoseconds: 8 buckets per power of two,
+// so a bucket is at most 12.5% wider than its lower bound
+class LoggerLatencyHistogram {
+public:
+	static const size_t SUB_BUCKET_BITS = 3;
+	static const size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS;
+
+	static size_t bucketIndex(uint64_t ns);
+	// smallest duration that falls into the bucket
+	static uint64_t bucketLowerBound(size_t index);
+	void add(uint64_t ns, uint64_t count = 1);
+	uint64_t getCount() const;
+	uint64_t getBucket(size_t index) const;
+	// upper bound of the bucket that contains the percentile, 0 if empty
+	uint64_t percentile(double p) const;
+
+private:
+	std::array<uint64_t, BUCKET_COUNT> buckets = { };
+	uint64_t count = 0;
+};
+
+// snapshot of Logger::getStats, all zero unless built with LOGGER_STATS
+struct LoggerStats {
+	// records that reached total_buffer, and their size
+	uint64_t lines = 0;
+	uint64_t bytes = 0;
+	// lines skipped because the current tag is disabled,
+	// because of manualDeactivate, or because active_switch is off outside of all tags,
+	// a line is counted once no matter how many writes it's made of
+	uint64_t suppressed_tag = 0;
+	uint64_t suppressed_manual = 0;
+	uint64_t suppressed_switch = 0;
+	uint64_t flushes = 0;
+	// time spent in flushLineBuffer (which includes internalFlush with autoflush) and in internalFlush
+	uint64_t line_flush_ns = 0;
+	uint64_t flush_ns = 0;
+	LoggerLatencyHistogram flush_latency;
+};
+
+// counters of a single thread, written only by that thread,
+// padded to cache lines so that threads don't share them
+struct alignas(64) LoggerThreadStats {
+	std::atomic<uint64_t> lines = 0;
+	std::atomic<uint64_t> bytes = 0;
+	std::atomic<uint64_t> suppressed_tag = 0;
+	std::atomic<uint64_t> suppressed_manual = 0;
+	std::atomic<uint64_t> suppressed_switch = 0;
+	std::atomic<uint64_t> flushes = 0;
+	std::atomic<uint64_t> line_flush_ns = 0;
+	std::atomic<uint64_t> flush_ns = 0;
+	std::array<std::atomic<uint64_t>, LoggerLatencyHistogram::BUCKET_COUNT> flush_latency = { };
+};
+
+// state that belongs to a single thread in thread-safe mode
+struct LoggerThreadState {
+	// keeps its capacity between lines
+	std::string line_buffer;
+	bool new_line = true;
+	ptrdiff_t indent_level = 0;
+	bool is_active = true;
+	uint64_t config_generation = 0;
+	std::vector<LoggerTagHandle> tags;
+	uint32_t thread_index = 0;
+	// finished lines waiting to be published: LoggerRecordInfo, u32 length, text,
+	// other threads publish the batch once it's older than batch_interval
+	std::mutex batch_mutex;
+	std::string batch;
+	size_t batch_lines = 0;
+	int64_t batch_time = 0;
+	// Logger::log formats the whole line here
+	std::string format_buffer;
+	// binary mode
+	std::string record_buffer;
+	int64_t line_time = 0;
+	bool line_continues = false;
+	std::vector<bool> formats_written;
+	// lines written outside of LOGGER_LOG reach all outputs
+	LoggerLevel line_level = LoggerLevel::Off;
+#if LOGGER_STATS
+	LoggerThreadStats stats;
+	// suppressed line without a newline so far, it's already counted
+	bool line_suppressed = false;
+#endif
+};
+
+// keeps the last capacity bytes of text lines in a ring allocated up front,
+// the ring is written to dump_path on demand or by the crash handler
+class LoggerFlightRecorder {
+public:
+	LoggerFlightRecorder(const std::filesystem::path& dump_path, size_t capacity = 4 * 1024 * 1024);
+	~LoggerFlightRecorder();
+	void write(std::string_view text);
+	// complete lines in the ring, oldest first
+	std::string getText() const;
+	// overwrites dump_path, returns false if it can't be opened
+	bool dump();
+	const std::filesystem::path& getDumpPath() const;
+	// dumps the ring on SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT (failed asserts),
+	// then the handler that was installed before runs, or the signal is raised again with the default one,
+	// one recorder can be installed at a time
+	void installCrashHandler();
+	// gives the calling thread a separate stack for signal handlers, so that a stack overflow is dumped too,
+	// installCrashHandler does this for its own thread, other threads call it themselves, no-op on Windows
+	static void installSignalStack();
+	// dumps the recorder installed with installCrashHandler, only the first call does anything,
+	// doesn't lock or allocate, for calling from other signal handlers
+	static void dumpInstalled();
+
+private:
+	std::filesystem::path dump_path;
+	std::unique_ptr<char[]> data;
+	size_t capacity = 0;
+	uint64_t written = 0;
+	mutable std::mutex mutex;
+
+	// complete lines in the ring as up to two parts
+	void getParts(std::string_view parts[2]) const;
+	// doesn't lock or allocate, safe in a signal handler
+	bool dumpUnlocked();
+};
+
 class Logger {
 public:
-	std::function<void(std::string line)> OnLineWrite = [](std::string line) { };
+	// called with every line as it is written, calls from different threads are serialized
+	std::function<void(std::string line)> OnLineWrite;
+	// called once per flush with all records written out by it, in binary mode records are encoded
+	std::function<void(std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos)> OnBatchWrite;
 
 	Logger(bool test = false);
+	~Logger();
 	Logger& operator<<(const char* value);
-	Logger& operator<<(std::string value);
+	Logger& operator<<(const std::string& value);
+	Logger& operator<<(std::string_view value);
 	Logger& operator<<(int value);
 	Logger& operator<<(unsigned int value);
 	Logger& operator<<(size_t value);
@@ -30,6 +741,25 @@ public:
 	Logger& operator<<(bool value);
 	Logger& operator<<(const std::filesystem::path& value);
 	Logger& operator<<(const LoggerFlush& value);
+	template<LoggerFixedString S>
+	Logger& operator<<(LoggerLiteral<S> literal);
+	template<LoggerCustomFormattable T>
+	Logger& operator<<(const T& value);
+	// callable runs only if the logger is active, its result is written:
+	// logger << [&] { return expensiveDump(obj); } << "\n";
+	template<std::invocable F> requires (!std::is_void_v<std::invoke_result_t<F>>)
+	Logger& operator<<(F&& callable);
+	// callable runs only if the logger is active and writes by itself:
+	// logger << [&](Logger& l) { dumpTree(l, root); };
+	template<std::invocable<Logger&> F>
+	Logger& operator<<(F&& callable);
+	// writes a whole line, each {} is replaced with the next argument:
+	// logger.log(LoggerLevel::Info, "x={} y={}", x, y);
+	// active state is checked once and the line is formatted in a single pass
+	template<typename... Args>
+	void log(LoggerLevel level, LoggerFormatString<std::type_identity_t<Args>...> format, const Args&... args);
+	template<typename... Args>
+	void record(uint32_t format_id, const char* format, const Args&... args);
 	void lock();
 	void unlock();
 	void manualActivate();
@@ -40,41 +770,189 @@ public:
 	void setAutoFlush(bool value);
 	bool getActiveSwitch() const;
 	void setActiveSwitch(bool value);
+	void enableAsync(const LoggerAsyncOptions& options = LoggerAsyncOptions());
+	void disableAsync();
+	bool isAsync() const;
+	size_t getDroppedCount() const;
+	void addSink(std::shared_ptr<LoggerSink> sink);
+	// sink gets its own worker thread with its own queue and overflow policy,
+	// records of a flush are copied once and shared with all such sinks
+	void addSink(std::shared_ptr<LoggerSink> sink, const LoggerAsyncOptions& options);
+	void removeSink(const std::shared_ptr<LoggerSink>& sink);
+	void clearSinks();
+	// sinks without their own worker
+	const std::vector<std::shared_ptr<LoggerSink>>& getSinks() const;
+	// batches dropped by the worker of a sink added with options
+	size_t getSinkDroppedCount(const std::shared_ptr<LoggerSink>& sink) const;
+	size_t getHighWaterMark() const;
+	void setHighWaterMark(size_t bytes);
+	LoggerLevel getLevel() const;
+	void setLevel(LoggerLevel level);
+	// true if lines of this level reach the output or the flight recorder
+	bool isLevelEnabled(LoggerLevel level) const;
+	// text lines of level and above are copied to recorder when they are finished,
+	// lines below getLevel() written with LOGGER_LOG go only to recorder, nullptr disables it,
+	// binary records are not recorded
+	void setFlightRecorder(std::shared_ptr<LoggerFlightRecorder> recorder, LoggerLevel level = LoggerLevel::Trace);
+	const std::shared_ptr<LoggerFlightRecorder>& getFlightRecorder() const;
+	// sum of the counters of all threads
+	LoggerStats getStats() const;
+	// writes a line for every call site of this logger with suppressed statements
+	void writeSuppressedSummary();
+	void writeSuppressedSummaryIfDue();
+	std::chrono::milliseconds getSuppressedSummaryInterval() const;
+	// summary is written when a rate limited statement passes after this time, 0 to disable
+	void setSuppressedSummaryInterval(std::chrono::milliseconds interval);
+	LoggerClock getClock() const;
+	void setClock(LoggerClock clock);
+	LoggerTimePrecision getTimePrecision() const;
+	void setTimePrecision(LoggerTimePrecision precision);
+	const LoggerIndentStyle& getIndentStyle() const;
+	// binary logs keep the style in effect when they were enabled
+	void setIndentStyle(const LoggerIndentStyle& style);
+	const LoggerNumberFormat& getNumberFormat() const;
+	// used for numbers written after the call, binary logs keep the format in effect when they were enabled
+	void setNumberFormat(const LoggerNumberFormat& format);
+	void enableThreadSafe(size_t ring_capacity = 4096);
+	void enableThreadSafe(const LoggerThreadSafeOptions& options);
+	bool isThreadSafe() const;
+	bool enableBinary(const std::filesystem::path& path);
+	void disableBinary();
+	bool isBinary() const;
 	static void disableStdWrite();
 	static void enableStdWrite();
-	std::vector<std::string>& getTags();
-	const std::vector<std::string>& getTags() const;
-	std::set<std::string>& getEnabledTags();
-	const std::set<std::string>& getEnabledTags() const;
-	std::set<std::string>& getDisabledTags();
-	const std::set<std::string>& getDisabledTags() const;
+	const std::vector<LoggerTagHandle>& getTags() const;
+	void pushTag(LoggerTagHandle tag);
+	void popTag();
+	bool isTagEnabled(LoggerTagHandle tag) const;
+	void setTagEnabled(LoggerTagHandle tag, bool value);
+	bool isTagDisabled(LoggerTagHandle tag) const;
+	void setTagDisabled(LoggerTagHandle tag, bool value);
 	void updateAcive();
+	bool isActive();
+	// if statements written here are not skipped
+	bool enabled();
+	// if statements inside LoggerTag(tag) are not skipped, doesn't depend on the current scope
+	bool enabled(LoggerTagHandle tag) const;
+	bool enabled(const std::string& tag) const;
 	const std::string& getLineBuffer() const;
 	const std::string& getTotalBuffer() const;
+	size_t getTotalBufferPages() const;
 
 private:
+	// publishes batches of exiting threads
+	friend struct LoggerThreadExit;
+	friend class LoggerLineLevel;
+	// call sites record the id of their logger
+	friend class LoggerCallSite;
+
+	inline static std::atomic<uint64_t> next_id = 1;
+	const uint64_t id = next_id++;
 	bool locked = false;
-	std::string line_buffer;
-	std::string total_buffer;
-	bool new_line = true;
-	ptrdiff_t indent_level = 0;
-	std::string indent_str;
-	bool autoflush = true;
+	LoggerThreadState main_state;
+	LoggerPageBuffer total_buffer;
+	// views into total_buffer
+	std::vector<std::string_view> records;
+	// metadata of records with the same index
+	std::vector<LoggerRecordInfo> record_infos;
+	// test mode keeps total_buffer, only the rest is written out
+	size_t flushed_records = 0;
+	size_t pending_size = 0;
+	// with autoflush disabled pending records are written out when they get larger than this
+	size_t high_water_mark = 4 * 1024 * 1024;
+	mutable std::string total_text;
+	// std::cout is used if there are no sinks
+	std::vector<std::shared_ptr<LoggerSink>> sinks;
+	// sinks receive line times, so lines are timed even without write_time
+	std::atomic<bool> has_sinks = false;
+	// outlives the stages, they release batches until they stop
+	LoggerSharedBatchPool shared_batch_pool;
+	std::vector<std::unique_ptr<LoggerSinkStage>> sink_stages;
+	std::atomic<bool> autoflush = true;
 	inline static bool std_write = true;
-	bool active_switch = true;
-	bool manual_switch_active = true;
-	bool is_active = true;
+	std::atomic<bool> active_switch = true;
+	std::atomic<bool> manual_switch_active = true;
+	std::atomic<LoggerLevel> level = LoggerLevel::Trace;
+	// lowest of level and recorder_level
+	std::atomic<LoggerLevel> enabled_level = LoggerLevel::Trace;
+	std::shared_ptr<LoggerFlightRecorder> flight_recorder;
+	LoggerLevel recorder_level = LoggerLevel::Off;
+	std::atomic<int64_t> suppressed_summary_interval = 10000;
+	std::atomic<int64_t> last_suppressed_summary = 0;
 	bool test_mode = false;
 	bool write_time = true;
-	std::vector<std::string> tags;
-	std::set<std::string> enabled_tags;
-	std::set<std::string> disabled_tags;
-
-	std::vector<std::string> splitString(const std::string& str);
-	std::string currentTime();
-	std::string boolToStr(bool value);
-	Logger& writeString(std::string value);
-	Logger& writeToLineBuffer(std::string value);
+	LoggerTimestamp timestamp;
+	LoggerNumberFormat number_format;
+	LoggerIndentTable indent_table;
+	static const uint8_t TAG_ENABLED = 1;
+	static const uint8_t TAG_DISABLED = 2;
+	// indexed by tag id
+	std::array<std::atomic<uint8_t>, LoggerTagRegistry::MAX_TAGS + 1> tag_flags = { };
+	std::unique_ptr<LoggerAsyncWriter> async_writer;
+	// thread-safe mode
+	bool thread_safe = false;
+	std::atomic<uint64_t> config_generation = 0;
+	LoggerThreadSafeOptions thread_safe_options;
+	std::unique_ptr<LoggerRingBuffer> ring;
+	// drained batches, merged by time
+	struct MergeLine {
+		LoggerRecordInfo info;
+		size_t offset;
+		size_t size;
+	};
+	std::string merge_text;
+	std::vector<MergeLine> merge_lines;
+	std::mutex consumer_mutex;
+	// serializes OnLineWrite calls of different threads
+	std::mutex line_write_mutex;
+	// time of the last search for batches of idle threads
+	std::atomic<int64_t> idle_batches_time = 0;
+	mutable std::mutex thread_states_mutex;
+	std::vector<std::unique_ptr<LoggerThreadState>> thread_states;
+	// binary mode
+	bool binary = false;
+	std::ofstream binary_file;
+
+	static void encodeArg(std::string& out, int value);
+	static void encodeArg(std::string& out, unsigned int value);
+	static void encodeArg(std::string& out, size_t value);
+	static void encodeArg(std::string& out, ptrdiff_t value);
+	static void encodeArg(std::string& out, float value);
+	static void encodeArg(std::string& out, double value);
+	static void encodeArg(std::string& out, bool value);
+	static void encodeArg(std::string& out, const char* value);
+	static void encodeArg(std::string& out, const std::string& value);
+	static void encodeArg(std::string& out, std::string_view value);
+	static void encodeArg(std::string& out, const std::filesystem::path& value);
+	// ends_line and text only tell statistics where a suppressed line ends
+	bool recordChecks(bool ends_line = false);
+	bool recordChecks(std::string_view text);
+#if LOGGER_STATS
+	void countSuppressed(LoggerThreadState& st, bool ends_line);
+#endif
+	std::string& beginBinaryRecord(uint32_t format_id, const char* format, size_t arg_count);
+	void endBinaryRecord();
+	void writeBinaryHeader(std::string& out, LoggerBinaryRecord type, uint8_t flags, int64_t time);
+	bool writeFormatLiteral(std::string_view& format);
+	template<typename... Args>
+	void writeFormatted(std::string_view format, const Args&... args);
+	void appendArg(std::string& out, int value);
+	void appendArg(std::string& out, unsigned int value);
+	void appendArg(std::string& out, size_t value);
+	void appendArg(std::string& out, ptrdiff_t value);
+	void appendArg(std::string& out, float value);
+	void appendArg(std::string& out, double value);
+	void appendArg(std::string& out, bool value);
+	void appendArg(std::string& out, const char* value);
+	void appendArg(std::string& out, const std::string& value);
+	void appendArg(std::string& out, std::string_view value);
+	void appendArg(std::string& out, const std::filesystem::path& value);
+	template<LoggerCustomFormattable T>
+	void appendArg(std::string& out, const T& value);
+	Logger& endFormattedLine(size_t start, size_t content_start, bool new_line);
+	const char* boolToStr(bool value);
+	Logger& writeString(std::string_view value);
+	Logger& writeToLineBuffer(std::string_view value);
 	Logger& writeNewLine();
 	Logger& writeInt(int value);
 	Logger& writeUnsignedInt(unsigned int value);
@@ -86,11 +964,199 @@ private:
 	Logger& writeDouble(double value);
 	Logger& writeBool(bool value);
 	Logger& writePath(const std::filesystem::path& value);
-	void updateIndentStr();
+	LoggerThreadState& state();
+	const LoggerThreadState& state() const;
+	LoggerThreadState& threadState();
+	void updateActive(LoggerThreadState& state);
+	void setTagFlag(LoggerTagHandle tag, uint8_t flag, bool value);
 	void internalFlush();
+	void writeToSinks(std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos);
+	void flushSinks();
 	void flushLineBuffer(bool newline = false);
+	void commitLine(const std::string& line);
+	LoggerRecordInfo recordInfo(const LoggerThreadState& st) const;
+	void storeRecord(std::string_view record, const LoggerRecordInfo& info);
+	void publishLine(std::string_view head, std::string_view line);
+	void appendToBatch(LoggerThreadState& st, const std::string& line);
+	void publishBatch(LoggerThreadState& st);
+	bool pushBatch(LoggerThreadState& st);
+	void publishIdleBatches(int64_t now);
+	void drainBatches();
+	void drainRing();
+	void consumeRing();
 };
 
+inline bool LoggerCallSite::everyN(Logger& logger, uint64_t n) {
+	if (count.fetch_add(1, std::memory_order_relaxed) % std::max((uint64_t)1, n) != 0) {
+		return suppress(logger);
+	}
+	return pass(logger);
+}
+
+inline bool LoggerCallSite::firstN(Logger& logger, uint64_t n) {
+	// once the limit is reached the check is a single load and compare
+	if (count.load(std::memory_order_relaxed) >= n || count.fetch_add(1, std::memory_order_relaxed) >= n) {
+		return suppress(logger);
+	}
+	return pass(logger);
+}
+
+inline bool LoggerCallSite::perSecond(Logger& logger, uint64_t n) {
+	// approximate under contention, a few extra lines can pass when the second changes
+	int64_t second = coarseSecond();
+	int64_t current = window.load(std::memory_order_relaxed);
+	if (current != second && window.compare_exchange_strong(current, second, std::memory_order_relaxed)) {
+		count.store(0, std::memory_order_relaxed);
+	}
+	if (count.load(std::memory_order_relaxed) >= n || count.fetch_add(1, std::memory_order_relaxed) >= n) {
+		return suppress(logger);
+	}
+	return pass(logger);
+}
+
+inline bool LoggerCallSite::suppress(Logger& logger) {
+	if (logger_id.load(std::memory_order_relaxed) != logger.id) {
+		logger_id.store(logger.id, std::memory_order_relaxed);
+	}
+	// statements that never pass would otherwise never write the summary
+	if ((suppressed.fetch_add(1, std::memory_order_relaxed) + 1) % SUMMARY_CHECK_PERIOD == 0) {
+		logger.writeSuppressedSummaryIfDue();
+	}
+	return false;
+}
+
+inline bool LoggerCallSite::pass(Logger& logger) {
+	logger.writeSuppressedSummaryIfDue();
+	return true;
+}
+
+// inline so that a disabled statement costs a single load and compare
+inline bool Logger::isLevelEnabled(LoggerLevel level) const {
+	return level >= enabled_level.load(std::memory_order_relaxed);
+}
+
+inline LoggerLineLevel::LoggerLineLevel(Logger& logger, LoggerLevel level) {
+	if (!logger.flight_recorder) {
+		return;
+	}
+	this->logger = &logger;
+	LoggerThreadState& st = logger.state();
+	previous = st.line_level;
+	st.line_level = level;
+}
+
+inline LoggerLineLevel::~LoggerLineLevel() {
+	if (logger) {
+		logger->state().line_level = previous;
+	}
+}
+
+inline bool Logger::enabled(LoggerTagHandle tag) const {
+	uint8_t flags = tag_flags[tag.id].load(std::memory_order_relaxed);
+	bool tag_active = active_switch.load(std::memory_order_relaxed) ? !(flags & TAG_DISABLED) : (flags & TAG_ENABLED);
+	return tag_active && manual_switch_active.load(std::memory_order_relaxed);
+}
+
+template<typename... Args>
+void Logger::record(uint32_t format_id, const char* format, const Args&... args) {
+	if (!recordChecks(true)) {
+		return;
+	}
+	if (binary) {
+		std::string& buffer = beginBinaryRecord(format_id, format, sizeof...(args));
+		(encodeArg(buffer, args), ...);
+		endBinaryRecord();
+	} else {
+		writeFormatted(format, args...);
+		writeNewLine();
+	}
+}
+
+template<typename... Args>
+void Logger::writeFormatted(std::string_view format, const Args&... args) {
+	((writeFormatLiteral(format), *this << args), ...);
+	writeString(format);
+}
+
+template<LoggerFixedString S>
+Logger& Logger::operator<<(LoggerLiteral<S>) {
+	using Literal = LoggerLiteral<S>;
+	if (!recordChecks(Literal::newline_count > 0)) {
+		return *this;
+	}
+	if constexpr (Literal::is_record) {
+		if (binary) {
+			beginBinaryRecord(Literal::id(), S.format, 0);
+			endBinaryRecord();
+			return *this;
+		}
+	}
+	if constexpr (Literal::newline_count == 0) {
+		if constexpr (!Literal::text.empty()) {
+			writeToLineBuffer(Literal::text);
+		}
+		return *this;
+	} else if constexpr (Literal::is_line) {
+		if constexpr (Literal::text.size() > 1) {
+			writeToLineBuffer(Literal::text.substr(0, Literal::text.size() - 1));
+		}
+		return writeNewLine();
+	} else {
+		return writeString(Literal::text);
+	}
+}
+
+template<LoggerCustomFormattable T>
+Logger& Logger::operator<<(const T& value) {
+	if (!recordChecks()) {
+		return *this;
+	}
+	std::string& buffer = state().format_buffer;
+	buffer.clear();
+	LoggerFormatter<T>::format(buffer, value);
+	return writeString(buffer);
+}
+
+template<std::invocable F> requires (!std::is_void_v<std::invoke_result_t<F>>)
+Logger& Logger::operator<<(F&& callable) {
+	if (!recordChecks()) {
+		return *this;
+	}
+	return *this << callable();
+}
+
+template<std::invocable<Logger&> F>
+Logger& Logger::operator<<(F&& callable) {
+	if (!recordChecks()) {
+		return *this;
+	}
+	callable(*this);
+	return *this;
+}
+
+template<typename... Args>
+void Logger::log(LoggerLevel level, LoggerFormatString<std::type_identity_t<Args>...> format, const Args&... args) {
+	if ((int)level < LOGGER_MIN_LEVEL || !isLevelEnabled(level) || !recordChecks(true)) {
+		return;
+	}
+	LoggerLineLevel line_level(*this, level);
+	LoggerThreadState& st = state();
+	size_t start = st.line_buffer.size();
+	bool new_line = st.new_line;
+	// prefix first, then arguments are formatted straight after it
+	writeToLineBuffer(std::string_view());
+	size_t content_start = st.line_buffer.size();
+	std::string_view rest = format.get();
+	((LoggerFormat::appendLiteral(st.line_buffer, rest), appendArg(st.line_buffer, args)), ...);
+	st.line_buffer += rest;
+	endFormattedLine(start, content_start, new_line);
+}
+
+template<LoggerCustomFormattable T>
+void Logger::appendArg(std::string& out, const T& value) {
+	LoggerFormatter<T>::format(out, value);
+}
+
 extern Logger logger;
 
 class LoggerControl {
@@ -148,13 +1214,15 @@ class LoggerTag : public LoggerControl {
 public:
 	LoggerTag(const std::string& tag);
 	LoggerTag(Logger& p_logger, const std::string& tag);
+	LoggerTag(LoggerTagHandle tag);
+	LoggerTag(Logger& p_logger, LoggerTagHandle tag);
 	~LoggerTag();
 	void internalClose() override;
 
 private:
 	Logger& m_logger;
 
-	void action(const std::string& tag);
+	void action(LoggerTagHandle tag);
 
 };
 
@@ -162,14 +1230,16 @@ class LoggerEnableTag : public LoggerControl {
 public:
 	LoggerEnableTag(const std::string& tag);
 	LoggerEnableTag(Logger& p_logger, const std::string& tag);
+	LoggerEnableTag(LoggerTagHandle tag);
+	LoggerEnableTag(Logger& p_logger, LoggerTagHandle tag);
 	~LoggerEnableTag();
 	void internalClose() override;
 
 private:
 	Logger& m_logger;
-	std::string tag;
+	LoggerTagHandle tag;
 
-	void action(const std::string& tag);
+	void action(LoggerTagHandle tag);
 
 };
 
@@ -177,13 +1247,15 @@ class LoggerDisableTag : public LoggerControl {
 public:
 	LoggerDisableTag(const std::string& tag);
 	LoggerDisableTag(Logger& p_logger, const std::string& tag);
+	LoggerDisableTag(LoggerTagHandle tag);
+	LoggerDisableTag(Logger& p_logger, LoggerTagHandle tag);
 	~LoggerDisableTag();
 	void internalClose() override;
 
 private:
 	Logger& m_logger;
-	std::string tag;
+	LoggerTagHandle tag;
 
-	void action(const std::string& tag);
+	void action(LoggerTagHandle tag);
 
 };
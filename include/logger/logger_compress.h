@@ -0,0 +1,53 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include "logger.h"
+
+// compressed stream: magic, then blocks of u8 type, u32 raw size, u32 payload size, payload,
+// blocks don't reference each other so a truncated stream loses only its last block,
+// streams appended to each other form a valid stream
+inline const char LOGGER_COMPRESSED_MAGIC[] = "CPPLOGZ1";
+
+enum class LoggerBlockType : uint8_t {
+	Stored = 0,
+	Compressed = 1,
+};
+
+// LZ77 block codec in the spirit of LZ4: sequences of literals followed by a match
+// of at least 4 bytes at an offset of at most 65535 bytes
+class LoggerBlockCodec {
+public:
+	static const size_t MIN_MATCH = 4;
+	static const size_t MAX_OFFSET = 65535;
+	// larger blocks are rejected by the decompressor
+	static const size_t MAX_BLOCK_SIZE = 64 * 1024 * 1024;
+
+	// appends compressed src to out, returns compressed size
+	size_t compress(std::string_view src, std::string& out);
+	// dst must be exactly the raw size, returns false if src is corrupted
+	static bool decompress(std::string_view src, char* dst, size_t dst_size);
+
+private:
+	static const size_t HASH_BITS = 14;
+	// position + 1 of the last occurrence of a hash, 0 if none
+	std::vector<uint32_t> table;
+
+	static void appendLength(std::string& out, size_t length);
+};
+
+// turns streams written by LoggerCompressedSink back into text
+class LoggerDecompressor {
+public:
+	// returns false if input is not a compressed log or is truncated,
+	// blocks before the error are written to output
+	bool decompress(std::istream& input, std::ostream& output);
+	const std::string& getError() const;
+
+private:
+	std::string payload;
+	std::string block;
+	std::string error;
+
+	bool fail(const std::string& message);
+};
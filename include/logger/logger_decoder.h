@@ -0,0 +1,30 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <unordered_map>
+#include "logger.h"
+
+// turns binary logs written in Logger binary mode back into text
+class LoggerBinaryDecoder {
+public:
+	// returns false if input is not a binary log or is truncated
+	bool decode(std::istream& input, std::ostream& output);
+	const std::string& getError() const;
+
+private:
+	LoggerTimestamp timestamp;
+	LoggerNumberFormat number_format;
+	LoggerIndentTable indent_table;
+	bool write_time = true;
+	std::unordered_map<uint32_t, std::string> formats;
+	std::string text;
+	std::string line;
+	std::string error;
+
+	bool fail(const std::string& message);
+	bool readHeader(std::istream& input);
+	bool readFormat(std::istream& input);
+	bool readLine(std::istream& input, LoggerBinaryRecord type, std::ostream& output);
+	bool readArg(std::istream& input);
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <ostream>
+#include <cstring>
+#include "logger.h"
+
+// shared memory segment written by LoggerShmSink and read by LoggerShmCollector,
+// named /<prefix>.<pid>.<n> where n numbers sinks of the process, header is followed by a ring of entries: u32 length, i64 time, text,
+// entries wrap around the end of the ring
+inline const char LOGGER_SHM_MAGIC[] = "CPPLOGS1";
+
+struct LoggerShmHeader {
+	char magic[8];
+	uint64_t capacity;
+	int64_t pid;
+	// written by the producer
+	std::atomic<uint64_t> write_pos;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint32_t> closed;
+	// written by the collector
+	alignas(64) std::atomic<uint64_t> read_pos;
+};
+
+const size_t LOGGER_SHM_DATA_OFFSET = (sizeof(LoggerShmHeader) + 63) / 64 * 64;
+const size_t LOGGER_SHM_ENTRY_HEADER = sizeof(uint32_t) + sizeof(int64_t);
+
+// copies size bytes to or from the ring at pos, wrapping around its end
+inline void loggerShmWrite(char* ring, uint64_t capacity, uint64_t pos, const void* data, size_t size) {
+	size_t offset = (size_t)(pos % capacity);
+	size_t first = std::min(size, (size_t)(capacity - offset));
+	memcpy(ring + offset, data, first);
+	memcpy(ring, (const char*)data + first, size - first);
+}
+
+inline void loggerShmRead(const char* ring, uint64_t capacity, uint64_t pos, void* data, size_t size) {
+	size_t offset = (size_t)(pos % capacity);
+	size_t first = std::min(size, (size_t)(capacity - offset));
+	memcpy(data, ring + offset, first);
+	memcpy((char*)data + first, ring, size - first);
+}
+
+// drains all segments of a prefix and writes their records merged by time,
+// records younger than merge_window are held back in case an older one is still on its way,
+// segments are found in /dev/shm, so it works on Linux only
+class LoggerShmCollector {
+public:
+	LoggerShmCollector(const std::string& prefix, std::chrono::microseconds merge_window = std::chrono::milliseconds(50));
+	~LoggerShmCollector();
+	// opens new segments, reads everything they have and writes merged records with one write,
+	// everything is written if flush_all is set, returns number of records written
+	size_t collect(std::ostream& output, bool flush_all = false);
+	size_t getSegmentCount() const;
+
+private:
+	struct Segment {
+		std::string name;
+		LoggerShmHeader* header = nullptr;
+		size_t mapping_size = 0;
+		uint64_t dropped = 0;
+	};
+	struct Entry {
+		int64_t time;
+		size_t offset;
+		size_t size;
+	};
+	std::string prefix;
+	std::chrono::microseconds merge_window;
+	std::vector<Segment> segments;
+	std::vector<Entry> entries;
+	std::string text;
+	std::string batch;
+
+	void openSegments();
+	void readSegment(Segment& segment);
+	bool isFinished(const Segment& segment) const;
+	void closeSegment(Segment& segment, bool unlink);
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+#include <ostream>
+#include "logger.h"
+#include "logger_compress.h"
+#include "logger_shm.h"
+
+// writes records to a std::ostream
+class LoggerStreamSink : public LoggerSink {
+public:
+	LoggerStreamSink(std::ostream& stream);
+	void write(std::span<const std::string_view> records) override;
+	void flush() override;
+
+private:
+	std::ostream& stream;
+};
+
+// writes each batch to standard output with a single system call
+class LoggerStdoutSink : public LoggerSink {
+public:
+	void write(std::span<const std::string_view> records) override;
+};
+
+// collects records in a buffer and writes it out when it's full
+class LoggerFileSink : public LoggerSink {
+public:
+	LoggerFileSink(const std::filesystem::path& path, size_t buffer_size = 64 * 1024);
+	~LoggerFileSink();
+	bool isOpen() const;
+	void write(std::span<const std::string_view> records) override;
+	void flush() override;
+
+private:
+	int fd = -1;
+	size_t buffer_size = 0;
+	std::string buffer;
+};
+
+// starts a new file when the current one grows past max_size or gets older than max_age,
+// old files are renamed to path.1, path.2, ... up to path.max_files
+class LoggerRotatingFileSink : public LoggerSink {
+public:
+	LoggerRotatingFileSink(
+		const std::filesystem::path& path,
+		size_t max_size,
+		std::chrono::seconds max_age = std::chrono::seconds(0),
+		size_t max_files = 5
+	);
+	~LoggerRotatingFileSink();
+	bool isOpen() const;
+	void write(std::span<const std::string_view> records) override;
+
+private:
+	std::filesystem::path path;
+	size_t max_size = 0;
+	std::chrono::seconds max_age;
+	size_t max_files = 0;
+	int fd = -1;
+	size_t file_size = 0;
+	std::chrono::steady_clock::time_point opened_at;
+
+	void open();
+	void rotate();
+	std::filesystem::path rotatedPath(size_t index) const;
+};
+
+// copies records into memory-mapped segments of fixed size: path.0, path.1, ...
+// written data survives a crash of the process without any fsync,
+// numbering continues after segments left by earlier runs, existing files are never overwritten,
+// segment is truncated to its used length when it's full or the sink is closed,
+// after a crash the last segment ends with zero bytes up to its full size,
+// on Windows records are appended to path.0 without mapping
+class LoggerMappedFileSink : public LoggerSink {
+public:
+	LoggerMappedFileSink(const std::filesystem::path& path, size_t segment_size = 64 * 1024 * 1024);
+	~LoggerMappedFileSink();
+	bool isOpen() const;
+	void write(std::span<const std::string_view> records) override;
+	size_t getSegmentCount() const;
+	// index counts segments written by this sink
+	std::filesystem::path getSegmentPath(size_t index) const;
+
+private:
+	std::filesystem::path path;
+	size_t segment_size = 0;
+	// numbers in segment names
+	std::vector<size_t> segment_numbers;
+	size_t next_number = 0;
+	int fd = -1;
+	char* mapping = nullptr;
+	size_t used = 0;
+
+	std::filesystem::path numberedPath(size_t number) const;
+	size_t findNextNumber() const;
+	void openSegment();
+	void closeSegment();
+};
+
+// collects records into blocks of block_size, compresses each full block
+// and passes it to sink as a single record, flush writes out the partial block,
+// a crash loses at most the unflushed block, logger-decompress restores the text
+class LoggerCompressedSink : public LoggerSink {
+public:
+	LoggerCompressedSink(std::shared_ptr<LoggerSink> sink, size_t block_size = 64 * 1024);
+	~LoggerCompressedSink();
+	void write(std::span<const std::string_view> records) override;
+	void flush() override;
+	// raw and written bytes so far
+	uint64_t getRawSize() const;
+	uint64_t getCompressedSize() const;
+
+private:
+	std::shared_ptr<LoggerSink> sink;
+	size_t block_size = 0;
+	std::string block;
+	std::string frame;
+	LoggerBlockCodec codec;
+	bool header_written = false;
+	uint64_t raw_size = 0;
+	uint64_t compressed_size = 0;
+
+	void writeBlock();
+};
+
+// publishes records into a shared memory ring /<prefix>.<pid>.<n> for logger-collect,
+// records that don't fit while the collector is behind are dropped, write never blocks,
+// records are stamped with the time of their line, the collector merges processes by it,
+// so their loggers should use LoggerClock::Wall, segment is removed when the sink is destroyed
+// or, if it still has unread records, by the collector after reading them,
+// records of binary mode don't reach sinks, so they aren't published,
+// does nothing on Windows
+class LoggerShmSink : public LoggerSink {
+public:
+	LoggerShmSink(const std::string& prefix, size_t capacity = 4 * 1024 * 1024);
+	~LoggerShmSink();
+	bool isOpen() const;
+	// without infos records are stamped with the time of the write
+	void write(std::span<const std::string_view> records) override;
+	void write(std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos) override;
+	const std::string& getName() const;
+	uint64_t getDroppedCount() const;
+
+private:
+	std::string name;
+	LoggerShmHeader* header = nullptr;
+	size_t mapping_size = 0;
+	int64_t last_time = 0;
+	std::mutex mutex;
+};
+
+// keeps the last records in memory
+class LoggerMemorySink : public LoggerSink {
+public:
+	LoggerMemorySink(size_t capacity = 1024);
+	void write(std::span<const std::string_view> records) override;
+	// oldest first
+	std::vector<std::string> getRecords() const;
+	std::string getText() const;
+
+private:
+	mutable std::mutex mutex;
+	// ring of reusable strings
+	std::vector<std::string> records;
+	size_t head = 0;
+	size_t size = 0;
+};
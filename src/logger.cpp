@@ -1,288 +1,1967 @@
 ﻿#include "logger.h"
 #include <cassert>
-#include <sstream>
-#include <iomanip>
+#include <cstring>
+#include <charconv>
+#include <algorithm>
+#include <csignal>
+#include <cerrno>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#endif
 
 #ifndef NDEBUG
 
 void _loggerAssert_print_msg(bool value) { }
 
-void _loggerAssert_print_msg(bool value, const std::string& message) {
-	if (!value) {
-		std::cout << message << "\n";
+void _loggerAssert_print_msg(bool value, const std::string& message) {
+	if (!value) {
+		std::cout << message << "\n";
+	}
+}
+
+#define loggerAssert(value, ...) \
+	_loggerAssert_print_msg(value __VA_OPT__(,) __VA_ARGS__); \
+	assert(value);
+
+#else
+
+#define loggerAssert(value, ...)
+
+#endif // !NDEBUG
+
+Logger logger;
+
+void LoggerSink::write(std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos) {
+	write(records);
+}
+
+LoggerAsyncWriter::LoggerAsyncWriter(const LoggerAsyncOptions& options, Output output, std::function<void()> flush_output)
+	: options(options), output(output), flush_output(flush_output) {
+	loggerAssert(options.capacity > 0);
+	queue.resize(options.capacity);
+	thread = std::thread(&LoggerAsyncWriter::run, this);
+}
+
+LoggerAsyncWriter::~LoggerAsyncWriter() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	not_empty.notify_one();
+	thread.join();
+}
+
+void LoggerAsyncWriter::push(std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos) {
+	std::unique_lock<std::mutex> lock(mutex);
+	if (queue_size == queue.size()) {
+		switch (options.overflow_policy) {
+			case LoggerOverflowPolicy::Block:
+				not_full.wait(lock, [this]() { return queue_size < queue.size(); });
+				break;
+			case LoggerOverflowPolicy::DropNewest:
+				dropped_count++;
+				return;
+			case LoggerOverflowPolicy::DropOldest:
+				queue_head = (queue_head + 1) % queue.size();
+				queue_size--;
+				dropped_count++;
+				break;
+		}
+	}
+	// existing slots are reused along with their capacity
+	Batch& batch = queue[(queue_head + queue_size) % queue.size()];
+	batch.text.clear();
+	batch.record_sizes.clear();
+	for (std::string_view record : records) {
+		batch.text += record;
+		batch.record_sizes.push_back(record.size());
+	}
+	batch.infos.assign(infos.begin(), infos.end());
+	queue_size++;
+	lock.unlock();
+	not_empty.notify_one();
+}
+
+void LoggerAsyncWriter::drain() {
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this]() { return queue_size == 0 && !writing; });
+	// writer thread can't start writing while the lock is held
+	flush_output();
+}
+
+size_t LoggerAsyncWriter::getDroppedCount() const {
+	return dropped_count;
+}
+
+void LoggerAsyncWriter::run() {
+	Batch batch;
+	std::vector<std::string_view> records;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		not_empty.wait(lock, [this]() { return queue_size > 0 || stopping; });
+		if (queue_size == 0) {
+			break;
+		}
+		// slot and local batch trade buffers, so nothing is allocated in steady state
+		std::swap(batch, queue[queue_head]);
+		queue_head = (queue_head + 1) % queue.size();
+		queue_size--;
+		writing = true;
+		lock.unlock();
+		not_full.notify_one();
+		records.clear();
+		size_t offset = 0;
+		for (size_t size : batch.record_sizes) {
+			records.push_back(std::string_view(batch.text).substr(offset, size));
+			offset += size;
+		}
+		output(records, batch.infos);
+		lock.lock();
+		writing = false;
+		if (queue_size == 0) {
+			idle.notify_all();
+		}
+	}
+	flush_output();
+	idle.notify_all();
+}
+
+LoggerSharedBatch* LoggerSharedBatchPool::take(size_t holders) {
+	LoggerSharedBatch* batch;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (free_batches.empty()) {
+			// pool grows up to the longest stage queue
+			batches.push_back(std::make_unique<LoggerSharedBatch>());
+			free_batches.push_back(batches.back().get());
+		}
+		batch = free_batches.back();
+		free_batches.pop_back();
+	}
+	batch->text.clear();
+	batch->records.clear();
+	batch->infos.clear();
+	batch->holders = holders;
+	return batch;
+}
+
+void LoggerSharedBatchPool::release(LoggerSharedBatch* batch) {
+	if (batch->holders.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		std::lock_guard<std::mutex> lock(mutex);
+		free_batches.push_back(batch);
+	}
+}
+
+LoggerSinkStage::LoggerSinkStage(std::shared_ptr<LoggerSink> sink, const LoggerAsyncOptions& options, LoggerSharedBatchPool& pool)
+	: sink(sink), options(options), pool(pool) {
+	loggerAssert(options.capacity > 0);
+	queue.resize(options.capacity);
+	thread = std::thread(&LoggerSinkStage::run, this);
+}
+
+LoggerSinkStage::~LoggerSinkStage() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	not_empty.notify_one();
+	thread.join();
+	sink->flush();
+}
+
+void LoggerSinkStage::push(LoggerSharedBatch* batch) {
+	std::unique_lock<std::mutex> lock(mutex);
+	if (queue_size == queue.size()) {
+		switch (options.overflow_policy) {
+			case LoggerOverflowPolicy::Block:
+				not_full.wait(lock, [this]() { return queue_size < queue.size(); });
+				break;
+			case LoggerOverflowPolicy::DropNewest:
+				dropped_count++;
+				lock.unlock();
+				pool.release(batch);
+				return;
+			case LoggerOverflowPolicy::DropOldest:
+				pool.release(queue[queue_head]);
+				queue_head = (queue_head + 1) % queue.size();
+				queue_size--;
+				dropped_count++;
+				break;
+		}
+	}
+	queue[(queue_head + queue_size) % queue.size()] = batch;
+	queue_size++;
+	lock.unlock();
+	not_empty.notify_one();
+}
+
+void LoggerSinkStage::drain() {
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this]() { return queue_size == 0 && !writing; });
+	// worker can't start writing while the lock is held
+	sink->flush();
+}
+
+size_t LoggerSinkStage::getDroppedCount() const {
+	return dropped_count;
+}
+
+const std::shared_ptr<LoggerSink>& LoggerSinkStage::getSink() const {
+	return sink;
+}
+
+void LoggerSinkStage::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		not_empty.wait(lock, [this]() { return queue_size > 0 || stopping; });
+		if (queue_size == 0) {
+			break;
+		}
+		LoggerSharedBatch* batch = queue[queue_head];
+		queue_head = (queue_head + 1) % queue.size();
+		queue_size--;
+		writing = true;
+		lock.unlock();
+		not_full.notify_one();
+		sink->write(batch->records, batch->infos);
+		pool.release(batch);
+		lock.lock();
+		writing = false;
+		if (queue_size == 0) {
+			idle.notify_all();
+		}
+	}
+}
+
+static void localTime(time_t t, tm& result) {
+#ifdef _WIN32
+	localtime_s(&result, &t);
+#else
+	localtime_r(&t, &result);
+#endif
+}
+
+static void writeDigits(char* out, int64_t value, size_t count) {
+	for (size_t i = count; i > 0; i--) {
+		out[i - 1] = '0' + value % 10;
+		value /= 10;
+	}
+}
+
+LoggerTimestamp::LoggerTimestamp() {
+	start = std::chrono::steady_clock::now();
+}
+
+LoggerClock LoggerTimestamp::getClock() const {
+	return clock;
+}
+
+void LoggerTimestamp::setClock(LoggerClock clock) {
+	this->clock = clock;
+	// invalidate cached text
+	while (!writeCache(INT64_MIN, "")) { }
+}
+
+LoggerTimePrecision LoggerTimestamp::getPrecision() const {
+	return precision;
+}
+
+void LoggerTimestamp::setPrecision(LoggerTimePrecision precision) {
+	this->precision = precision;
+}
+
+int64_t LoggerTimestamp::now() const {
+	using namespace std::chrono;
+	if (clock == LoggerClock::Monotonic) {
+		return duration_cast<microseconds>(steady_clock::now() - start).count();
+	}
+	return duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+void LoggerTimestamp::write(std::string& buffer, int64_t time) {
+	int64_t second = time / 1000000;
+	int64_t fraction = time % 1000000;
+	if (fraction < 0) {
+		second--;
+		fraction += 1000000;
+	}
+	char text[TEXT_SIZE];
+	if (!readCache(second, text)) {
+		formatSecond(second, text);
+		writeCache(second, text);
+	}
+	buffer += '[';
+	buffer.append(text, strnlen(text, TEXT_SIZE));
+	char fraction_str[8] = ".";
+	if (precision == LoggerTimePrecision::Milliseconds) {
+		writeDigits(fraction_str + 1, fraction / 1000, 3);
+		buffer.append(fraction_str, 4);
+	} else if (precision == LoggerTimePrecision::Microseconds) {
+		writeDigits(fraction_str + 1, fraction, 6);
+		buffer.append(fraction_str, 7);
+	}
+	buffer += "] ";
+}
+
+bool LoggerTimestamp::readCache(int64_t second, char* text) const {
+	uint64_t words[TEXT_SIZE / sizeof(uint64_t)];
+	while (true) {
+		uint64_t seq_before = sequence.load(std::memory_order_acquire);
+		if (seq_before & 1) {
+			// writer is in the middle of an update, formatting is cheaper than waiting
+			return false;
+		}
+		int64_t cached = cached_second.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < std::size(words); i++) {
+			words[i] = cached_text[i].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (sequence.load(std::memory_order_relaxed) != seq_before) {
+			continue;
+		}
+		if (cached != second) {
+			return false;
+		}
+		memcpy(text, words, TEXT_SIZE);
+		return true;
+	}
+}
+
+bool LoggerTimestamp::writeCache(int64_t second, const char* text) {
+	uint64_t seq = sequence.load(std::memory_order_relaxed);
+	if ((seq & 1) || !sequence.compare_exchange_strong(seq, seq + 1, std::memory_order_acquire)) {
+		// some other thread is updating the cache
+		return false;
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+	uint64_t words[TEXT_SIZE / sizeof(uint64_t)] = { };
+	memcpy(words, text, strnlen(text, TEXT_SIZE));
+	cached_second.store(second, std::memory_order_relaxed);
+	for (size_t i = 0; i < std::size(words); i++) {
+		cached_text[i].store(words[i], std::memory_order_relaxed);
+	}
+	sequence.store(seq + 2, std::memory_order_release);
+	return true;
+}
+
+void LoggerTimestamp::formatSecond(int64_t second, char* text) const {
+	int64_t hours, minutes, seconds;
+	if (clock == LoggerClock::Monotonic) {
+		hours = second / 3600;
+		minutes = second / 60 % 60;
+		seconds = second % 60;
+	} else {
+		tm l;
+		localTime((time_t)second, l);
+		hours = l.tm_hour;
+		minutes = l.tm_min;
+		seconds = l.tm_sec;
+	}
+	size_t hour_digits = 2;
+	for (int64_t h = hours; h >= 100 && hour_digits < 8; h /= 10) {
+		hour_digits++;
+	}
+	memset(text, 0, TEXT_SIZE);
+	writeDigits(text, hours, hour_digits);
+	text[hour_digits] = ':';
+	writeDigits(text + hour_digits + 1, minutes, 2);
+	text[hour_digits + 3] = ':';
+	writeDigits(text + hour_digits + 4, seconds, 2);
+}
+
+LoggerRingBuffer::LoggerRingBuffer(size_t capacity) {
+	size_t size = 1;
+	while (size < capacity) {
+		size *= 2;
+	}
+	slots = std::make_unique<Slot[]>(size);
+	for (size_t i = 0; i < size; i++) {
+		slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	mask = size - 1;
+}
+
+bool LoggerRingBuffer::tryPush(std::string_view head, std::string_view text) {
+	size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+	Slot* slot;
+	while (true) {
+		slot = &slots[pos & mask];
+		size_t sequence = slot->sequence.load(std::memory_order_acquire);
+		ptrdiff_t diff = (ptrdiff_t)sequence - (ptrdiff_t)pos;
+		if (diff == 0) {
+			if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+	slot->text.assign(head);
+	slot->text.append(text);
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	return true;
+}
+
+const std::string* LoggerRingBuffer::peek() const {
+	size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+	const Slot& slot = slots[pos & mask];
+	size_t sequence = slot.sequence.load(std::memory_order_acquire);
+	if (sequence != pos + 1) {
+		return nullptr;
+	}
+	return &slot.text;
+}
+
+void LoggerRingBuffer::pop() {
+	size_t pos = dequeue_pos.load(std::memory_order_relaxed);
+	slots[pos & mask].sequence.store(pos + mask + 1, std::memory_order_release);
+	dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+}
+
+LoggerIndentTable::LoggerIndentTable(const LoggerIndentStyle& style) : style(style) {
+	std::string unit = style.glyph;
+	if (unit.size() < style.width) {
+		unit.append(style.width - unit.size(), ' ');
+	}
+	unit_size = unit.size();
+	table.reserve(unit_size * TABLE_DEPTH);
+	for (size_t i = 0; i < TABLE_DEPTH; i++) {
+		table += unit;
+	}
+}
+
+const LoggerIndentStyle& LoggerIndentTable::getStyle() const {
+	return style;
+}
+
+std::string_view LoggerIndentTable::getUnit() const {
+	return std::string_view(table.data(), unit_size);
+}
+
+void LoggerIndentTable::append(std::string& out, ptrdiff_t depth) const {
+	size_t levels = (size_t)std::max((ptrdiff_t)0, depth);
+	if (style.max_depth > 0) {
+		levels = std::min(levels, style.max_depth);
+	}
+	while (levels > TABLE_DEPTH) {
+		out += table;
+		levels -= TABLE_DEPTH;
+	}
+	out.append(table.data(), levels * unit_size);
+}
+
+LoggerPageBuffer::LoggerPageBuffer(size_t page_size) : page_size(page_size) { }
+
+std::string_view LoggerPageBuffer::append(std::string_view record) {
+	if (pages.empty() || pages.back().capacity - pages.back().size < record.size()) {
+		if (record.size() > page_size) {
+			// oversized record gets a page of its own
+			Page page;
+			page.data = std::make_unique<char[]>(record.size());
+			page.capacity = record.size();
+			pages.push_back(std::move(page));
+		} else if (!free_pages.empty()) {
+			pages.push_back(std::move(free_pages.back()));
+			free_pages.pop_back();
+		} else {
+			Page page;
+			page.data = std::make_unique<char[]>(page_size);
+			page.capacity = page_size;
+			pages.push_back(std::move(page));
+		}
+	}
+	Page& page = pages.back();
+	char* dest = page.data.get() + page.size;
+	memcpy(dest, record.data(), record.size());
+	page.size += record.size();
+	total_size += record.size();
+	return std::string_view(dest, record.size());
+}
+
+size_t LoggerPageBuffer::size() const {
+	return total_size;
+}
+
+bool LoggerPageBuffer::empty() const {
+	return total_size == 0;
+}
+
+void LoggerPageBuffer::clear() {
+	for (Page& page : pages) {
+		if (page.capacity == page_size) {
+			page.size = 0;
+			free_pages.push_back(std::move(page));
+		}
+	}
+	pages.clear();
+	total_size = 0;
+}
+
+std::string LoggerPageBuffer::str() const {
+	std::string result;
+	result.reserve(total_size);
+	for (const Page& page : pages) {
+		result.append(page.data.get(), page.size);
+	}
+	return result;
+}
+
+size_t LoggerPageBuffer::getPageCount() const {
+	return pages.size();
+}
+
+bool LoggerRingBuffer::empty() const {
+	return enqueue_pos.load(std::memory_order_acquire) == dequeue_pos.load(std::memory_order_relaxed);
+}
+
+template<typename T>
+static std::string_view formatInteger(char* buffer, T value, const LoggerNumberFormat& options) {
+	char* end = buffer + LoggerFormat::MAX_NUMBER_LENGTH;
+	std::to_chars_result result = std::to_chars(buffer, end, value, options.hex ? 16 : 10);
+	return std::string_view(buffer, result.ptr - buffer);
+}
+
+template<typename T>
+static std::string_view formatFloat(char* buffer, T value, const LoggerNumberFormat& options) {
+	char* end = buffer + LoggerFormat::MAX_NUMBER_LENGTH;
+	int precision = std::min<int>(options.precision, LoggerFormat::MAX_PRECISION);
+	std::to_chars_result result;
+	switch (options.float_format) {
+		case LoggerFloatFormat::Fixed:
+			result = std::to_chars(buffer, end, value, std::chars_format::fixed, precision);
+			break;
+		case LoggerFloatFormat::Scientific:
+			result = std::to_chars(buffer, end, value, std::chars_format::scientific, precision);
+			break;
+		default:
+			result = std::to_chars(buffer, end, value);
+			break;
+	}
+	assert(result.ec == std::errc() && "Number does not fit into the format buffer");
+	return std::string_view(buffer, result.ptr - buffer);
+}
+
+std::string_view LoggerFormat::format(char* buffer, int value, const LoggerNumberFormat& options) {
+	return formatInteger(buffer, value, options);
+}
+
+std::string_view LoggerFormat::format(char* buffer, unsigned int value, const LoggerNumberFormat& options) {
+	return formatInteger(buffer, value, options);
+}
+
+std::string_view LoggerFormat::format(char* buffer, size_t value, const LoggerNumberFormat& options) {
+	return formatInteger(buffer, value, options);
+}
+
+std::string_view LoggerFormat::format(char* buffer, ptrdiff_t value, const LoggerNumberFormat& options) {
+	return formatInteger(buffer, value, options);
+}
+
+std::string_view LoggerFormat::format(char* buffer, float value, const LoggerNumberFormat& options) {
+	return formatFloat(buffer, value, options);
+}
+
+std::string_view LoggerFormat::format(char* buffer, double value, const LoggerNumberFormat& options) {
+	return formatFloat(buffer, value, options);
+}
+
+void LoggerFormat::append(std::string& out, int value, const LoggerNumberFormat& options) {
+	char buffer[MAX_NUMBER_LENGTH];
+	out += format(buffer, value, options);
+}
+
+void LoggerFormat::append(std::string& out, unsigned int value, const LoggerNumberFormat& options) {
+	char buffer[MAX_NUMBER_LENGTH];
+	out += format(buffer, value, options);
+}
+
+void LoggerFormat::append(std::string& out, size_t value, const LoggerNumberFormat& options) {
+	char buffer[MAX_NUMBER_LENGTH];
+	out += format(buffer, value, options);
+}
+
+void LoggerFormat::append(std::string& out, ptrdiff_t value, const LoggerNumberFormat& options) {
+	char buffer[MAX_NUMBER_LENGTH];
+	out += format(buffer, value, options);
+}
+
+void LoggerFormat::append(std::string& out, float value, const LoggerNumberFormat& options) {
+	char buffer[MAX_NUMBER_LENGTH];
+	out += format(buffer, value, options);
+}
+
+void LoggerFormat::append(std::string& out, double value, const LoggerNumberFormat& options) {
+	char buffer[MAX_NUMBER_LENGTH];
+	out += format(buffer, value, options);
+}
+
+void LoggerFormat::append(std::string& out, bool value) {
+	out += value ? "true" : "false";
+}
+
+bool LoggerFormat::appendLiteral(std::string& out, std::string_view& format) {
+	size_t pos = format.find("{}");
+	if (pos == std::string_view::npos) {
+		out += format;
+		format = std::string_view();
+		return false;
+	}
+	out += format.substr(0, pos);
+	format.remove_prefix(pos + 2);
+	return true;
+}
+
+uint32_t LoggerFormatRegistry::registerFormat(const char* format) {
+	LoggerFormatRegistry& registry = instance();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	auto it = registry.ids.find(format);
+	if (it != registry.ids.end()) {
+		return it->second;
+	}
+	uint32_t id = (uint32_t)registry.ids.size();
+	registry.ids[format] = id;
+	return id;
+}
+
+LoggerFormatRegistry& LoggerFormatRegistry::instance() {
+	static LoggerFormatRegistry registry;
+	return registry;
+}
+
+LoggerCallSite::LoggerCallSite(const char* file, int line) : file(file), line(line) {
+	next = first.load(std::memory_order_relaxed);
+	while (!first.compare_exchange_weak(next, this, std::memory_order_release, std::memory_order_relaxed)) { }
+}
+
+const char* LoggerCallSite::getFile() const {
+	return file;
+}
+
+int LoggerCallSite::getLine() const {
+	return line;
+}
+
+uint64_t LoggerCallSite::takeSuppressed() {
+	return suppressed.exchange(0, std::memory_order_relaxed);
+}
+
+uint64_t LoggerCallSite::getLoggerId() const {
+	return logger_id.load(std::memory_order_relaxed);
+}
+
+int64_t LoggerCallSite::coarseSecond() {
+#ifdef CLOCK_MONOTONIC_COARSE
+	// kernel keeps this time cached, reading it doesn't touch the hardware clock
+	timespec time;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+	return time.tv_sec;
+#else
+	return std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count();
+#endif
+}
+
+LoggerCallSite* LoggerCallSite::getFirst() {
+	return first.load(std::memory_order_acquire);
+}
+
+LoggerCallSite* LoggerCallSite::getNext() const {
+	return next;
+}
+
+LoggerTagHandle LoggerTagRegistry::registerTag(const std::string& name) {
+	LoggerTagRegistry& registry = instance();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	auto it = registry.ids.find(name);
+	if (it != registry.ids.end()) {
+		return LoggerTagHandle { it->second };
+	}
+	if (registry.names.size() >= MAX_TAGS) {
+		// flags are a fixed array, so extra tags can't get their own slot
+		registry.ids[name] = OVERFLOW_TAG;
+		return LoggerTagHandle { OVERFLOW_TAG };
+	}
+	uint32_t id = (uint32_t)registry.names.size();
+	registry.names.push_back(name);
+	registry.ids[name] = id;
+	return LoggerTagHandle { id };
+}
+
+bool LoggerTagRegistry::findTag(const std::string& name, LoggerTagHandle& tag) {
+	LoggerTagRegistry& registry = instance();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	auto it = registry.ids.find(name);
+	if (it == registry.ids.end()) {
+		return false;
+	}
+	tag = LoggerTagHandle { it->second };
+	return true;
+}
+
+const std::string& LoggerTagRegistry::getName(LoggerTagHandle tag) {
+	static const std::string overflow_name = "<overflow>";
+	LoggerTagRegistry& registry = instance();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	if (tag.id >= registry.names.size()) {
+		return overflow_name;
+	}
+	return registry.names[tag.id];
+}
+
+LoggerTagRegistry& LoggerTagRegistry::instance() {
+	static LoggerTagRegistry registry;
+	return registry;
+}
+
+static std::atomic<LoggerFlightRecorder*> crash_recorder = nullptr;
+static const int CRASH_SIGNALS[] = {
+	SIGSEGV,
+	SIGABRT,
+	SIGFPE,
+	SIGILL,
+#ifdef SIGBUS
+	SIGBUS,
+#endif
+};
+const size_t CRASH_SIGNAL_COUNT = sizeof(CRASH_SIGNALS) / sizeof(CRASH_SIGNALS[0]);
+
+#ifdef _WIN32
+
+static void crashHandler(int signal) {
+	LoggerFlightRecorder::dumpInstalled();
+	std::signal(signal, SIG_DFL);
+	std::raise(signal);
+}
+
+#else
+
+static struct sigaction previous_crash_actions[CRASH_SIGNAL_COUNT];
+static std::atomic<bool> crash_handlers_installed = false;
+
+static void crashHandler(int signal, siginfo_t* info, void* context) {
+	LoggerFlightRecorder::dumpInstalled();
+	for (size_t i = 0; i < CRASH_SIGNAL_COUNT; i++) {
+		if (CRASH_SIGNALS[i] != signal) {
+			continue;
+		}
+		const struct sigaction& previous = previous_crash_actions[i];
+		// previous handler stays installed, so it also gets the signal if the fault repeats
+		sigaction(signal, &previous, nullptr);
+		if (previous.sa_flags & SA_SIGINFO) {
+			previous.sa_sigaction(signal, info, context);
+			return;
+		}
+		if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+			previous.sa_handler(signal);
+			return;
+		}
+	}
+	// default action once the handler returns, faults happen again and are fatal this time
+	::signal(signal, SIG_DFL);
+	raise(signal);
+}
+
+#endif
+
+LoggerFlightRecorder::LoggerFlightRecorder(const std::filesystem::path& dump_path, size_t capacity) : dump_path(dump_path) {
+	this->capacity = std::max((size_t)1, capacity);
+	data = std::make_unique<char[]>(this->capacity);
+}
+
+LoggerFlightRecorder::~LoggerFlightRecorder() {
+	LoggerFlightRecorder* self = this;
+	crash_recorder.compare_exchange_strong(self, nullptr);
+}
+
+void LoggerFlightRecorder::write(std::string_view text) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (text.size() > capacity) {
+		written += text.size() - capacity;
+		text = text.substr(text.size() - capacity);
+	}
+	size_t pos = written % capacity;
+	size_t first = std::min(text.size(), capacity - pos);
+	memcpy(data.get() + pos, text.data(), first);
+	memcpy(data.get(), text.data() + first, text.size() - first);
+	written += text.size();
+}
+
+std::string LoggerFlightRecorder::getText() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::string_view parts[2];
+	getParts(parts);
+	std::string result;
+	result.reserve(parts[0].size() + parts[1].size());
+	result += parts[0];
+	result += parts[1];
+	return result;
+}
+
+bool LoggerFlightRecorder::dump() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return dumpUnlocked();
+}
+
+const std::filesystem::path& LoggerFlightRecorder::getDumpPath() const {
+	return dump_path;
+}
+
+void LoggerFlightRecorder::installCrashHandler() {
+	crash_recorder = this;
+#ifdef _WIN32
+	for (int signal : CRASH_SIGNALS) {
+		std::signal(signal, crashHandler);
+	}
+#else
+	installSignalStack();
+	if (crash_handlers_installed.exchange(true)) {
+		// replacing the handlers would make them their own previous handlers
+		return;
+	}
+	struct sigaction action = { };
+	action.sa_sigaction = crashHandler;
+	action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+	sigemptyset(&action.sa_mask);
+	for (size_t i = 0; i < CRASH_SIGNAL_COUNT; i++) {
+		sigaction(CRASH_SIGNALS[i], &action, &previous_crash_actions[i]);
+	}
+#endif
+}
+
+void LoggerFlightRecorder::installSignalStack() {
+#ifndef _WIN32
+	struct SignalStack {
+		std::unique_ptr<char[]> memory;
+		~SignalStack() {
+			if (memory) {
+				stack_t disabled = { };
+				disabled.ss_flags = SS_DISABLE;
+				sigaltstack(&disabled, nullptr);
+			}
+		}
+	};
+	thread_local SignalStack signal_stack;
+	if (signal_stack.memory) {
+		return;
+	}
+	const size_t size = std::max((size_t)SIGSTKSZ, (size_t)64 * 1024);
+	signal_stack.memory = std::make_unique<char[]>(size);
+	stack_t stack = { };
+	stack.ss_sp = signal_stack.memory.get();
+	stack.ss_size = size;
+	if (sigaltstack(&stack, nullptr) != 0) {
+		signal_stack.memory.reset();
+	}
+#endif
+}
+
+void LoggerFlightRecorder::dumpInstalled() {
+	LoggerFlightRecorder* recorder = crash_recorder.exchange(nullptr);
+	if (recorder) {
+		// the crashed thread may hold the mutex, a line being written can be torn
+		recorder->dumpUnlocked();
+	}
+}
+
+void LoggerFlightRecorder::getParts(std::string_view parts[2]) const {
+	if (written <= capacity) {
+		parts[0] = std::string_view(data.get(), written);
+		parts[1] = std::string_view();
+		return;
+	}
+	size_t pos = written % capacity;
+	parts[0] = std::string_view(data.get() + pos, capacity - pos);
+	parts[1] = std::string_view(data.get(), pos);
+	// oldest line was partially overwritten
+	for (std::string_view& part : std::span(parts, 2)) {
+		size_t newline = part.find('\n');
+		if (newline != std::string_view::npos) {
+			part.remove_prefix(newline + 1);
+			break;
+		}
+		part = std::string_view();
+	}
+}
+
+bool LoggerFlightRecorder::dumpUnlocked() {
+	std::string_view parts[2];
+	getParts(parts);
+#ifdef _WIN32
+	int fd = _wopen(dump_path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	int fd = open(dump_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+#endif
+	if (fd < 0) {
+		return false;
+	}
+	for (std::string_view part : parts) {
+		while (!part.empty()) {
+#ifdef _WIN32
+			int result = _write(fd, part.data(), (unsigned int)part.size());
+#else
+			ssize_t result = ::write(fd, part.data(), part.size());
+			if (result < 0 && errno == EINTR) {
+				continue;
+			}
+#endif
+			if (result <= 0) {
+				break;
+			}
+			part.remove_prefix(result);
+		}
+	}
+#ifdef _WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+	return true;
+}
+
+// ids of loggers that weren't destroyed yet, threads use it to drop
+// cached states of destroyed loggers, never destroyed like batchLoggers
+static std::mutex& liveLoggersMutex() {
+	static std::mutex* mutex = new std::mutex();
+	return *mutex;
+}
+
+static std::unordered_set<uint64_t>& liveLoggers() {
+	static std::unordered_set<uint64_t>* loggers = new std::unordered_set<uint64_t>();
+	return *loggers;
+}
+
+Logger::Logger(bool test) {
+	if (test) {
+		test_mode = true;
+		write_time = false;
+	}
+	std::lock_guard<std::mutex> lock(liveLoggersMutex());
+	liveLoggers().insert(id);
+}
+
+// loggers with batched thread contexts, exiting threads only publish
+// their batches to loggers that are still alive, never destroyed so
+// that threads exiting during static destruction can still use it
+static std::mutex& batchLoggersMutex() {
+	static std::mutex* mutex = new std::mutex();
+	return *mutex;
+}
+
+static std::unordered_map<uint64_t, Logger*>& batchLoggers() {
+	static std::unordered_map<uint64_t, Logger*>* loggers = new std::unordered_map<uint64_t, Logger*>();
+	return *loggers;
+}
+
+struct LoggerThreadExit {
+	struct Entry {
+		uint64_t logger_id;
+		LoggerThreadState* state;
+	};
+	std::vector<Entry> entries;
+
+	~LoggerThreadExit() {
+		std::lock_guard<std::mutex> lock(batchLoggersMutex());
+		for (const Entry& entry : entries) {
+			auto it = batchLoggers().find(entry.logger_id);
+			if (it != batchLoggers().end()) {
+				it->second->publishBatch(*entry.state);
+			}
+		}
+	}
+};
+
+Logger::~Logger() {
+	{
+		std::lock_guard<std::mutex> lock(liveLoggersMutex());
+		liveLoggers().erase(id);
+	}
+	if (thread_safe_options.batch_lines > 0) {
+		std::lock_guard<std::mutex> lock(batchLoggersMutex());
+		batchLoggers().erase(id);
+	}
+	// writer thread drains the queue before stopping
+	async_writer.reset();
+}
+
+#define LOGGER_CHECKS() \
+	if (!recordChecks()) { \
+		return *this; \
+	}
+
+// const char* would pick the bool overload
+#define LOGGER_TEXT_CHECKS(text) \
+	if (!recordChecks(std::string_view(text))) { \
+		return *this; \
+	}
+
+#if LOGGER_STATS
+
+// only the owning thread writes its counters, so a relaxed load and store are enough
+static void statAdd(std::atomic<uint64_t>& counter, uint64_t value) {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+static uint64_t statNow() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Logger::countSuppressed(LoggerThreadState& st, bool ends_line) {
+	// line is counted at its first suppressed write
+	if (!st.line_suppressed) {
+		if (!manual_switch_active.load(std::memory_order_relaxed)) {
+			statAdd(st.stats.suppressed_manual, 1);
+		} else if (st.tags.empty()) {
+			statAdd(st.stats.suppressed_switch, 1);
+		} else {
+			statAdd(st.stats.suppressed_tag, 1);
+		}
+	}
+	st.line_suppressed = !ends_line;
+}
+
+#endif // LOGGER_STATS
+
+size_t LoggerLatencyHistogram::bucketIndex(uint64_t ns) {
+	const uint64_t sub_buckets = (uint64_t)1 << SUB_BUCKET_BITS;
+	if (ns < sub_buckets) {
+		return (size_t)ns;
+	}
+	size_t msb = 63 - std::countl_zero(ns);
+	size_t sub_bucket = (size_t)(ns >> (msb - SUB_BUCKET_BITS)) & (sub_buckets - 1);
+	return ((msb - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + sub_bucket;
+}
+
+uint64_t LoggerLatencyHistogram::bucketLowerBound(size_t index) {
+	const size_t sub_buckets = (size_t)1 << SUB_BUCKET_BITS;
+	if (index < sub_buckets) {
+		return index;
+	}
+	size_t msb = (index >> SUB_BUCKET_BITS) + SUB_BUCKET_BITS - 1;
+	uint64_t mantissa = sub_buckets + (index & (sub_buckets - 1));
+	return mantissa << (msb - SUB_BUCKET_BITS);
+}
+
+void LoggerLatencyHistogram::add(uint64_t ns, uint64_t count) {
+	buckets[bucketIndex(ns)] += count;
+	this->count += count;
+}
+
+uint64_t LoggerLatencyHistogram::getCount() const {
+	return count;
+}
+
+uint64_t LoggerLatencyHistogram::getBucket(size_t index) const {
+	return buckets[index];
+}
+
+uint64_t LoggerLatencyHistogram::percentile(double p) const {
+	if (count == 0) {
+		return 0;
+	}
+	uint64_t rank = std::max((uint64_t)1, (uint64_t)(p / 100.0 * count + 0.5));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BUCKET_COUNT; i++) {
+		seen += buckets[i];
+		if (seen >= rank) {
+			return i + 1 < BUCKET_COUNT ? bucketLowerBound(i + 1) - 1 : UINT64_MAX;
+		}
+	}
+	return UINT64_MAX;
+}
+
+LoggerStats Logger::getStats() const {
+	LoggerStats result;
+#if LOGGER_STATS
+	auto addThread = [&](const LoggerThreadStats& stats) {
+		result.lines += stats.lines.load(std::memory_order_relaxed);
+		result.bytes += stats.bytes.load(std::memory_order_relaxed);
+		result.suppressed_tag += stats.suppressed_tag.load(std::memory_order_relaxed);
+		result.suppressed_manual += stats.suppressed_manual.load(std::memory_order_relaxed);
+		result.suppressed_switch += stats.suppressed_switch.load(std::memory_order_relaxed);
+		result.flushes += stats.flushes.load(std::memory_order_relaxed);
+		result.line_flush_ns += stats.line_flush_ns.load(std::memory_order_relaxed);
+		result.flush_ns += stats.flush_ns.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < LoggerLatencyHistogram::BUCKET_COUNT; i++) {
+			uint64_t count = stats.flush_latency[i].load(std::memory_order_relaxed);
+			if (count > 0) {
+				result.flush_latency.add(LoggerLatencyHistogram::bucketLowerBound(i), count);
+			}
+		}
+	};
+	addThread(main_state.stats);
+	std::lock_guard<std::mutex> lock(thread_states_mutex);
+	for (const std::unique_ptr<LoggerThreadState>& st : thread_states) {
+		addThread(st->stats);
+	}
+#endif
+	return result;
+}
+
+Logger& Logger::operator<<(const char* value) {
+	LOGGER_TEXT_CHECKS(value);
+	return writeString(std::string_view(value));
+}
+
+Logger& Logger::operator<<(const std::string& value) {
+	LOGGER_TEXT_CHECKS(value);
+	return writeString(value);
+}
+
+Logger& Logger::operator<<(std::string_view value) {
+	LOGGER_TEXT_CHECKS(value);
+	return writeString(value);
+}
+
+Logger& Logger::operator<<(int value) {
+	LOGGER_CHECKS();
+	return writeInt(value);
+}
+
+Logger& Logger::operator<<(unsigned int value) {
+	LOGGER_CHECKS();
+	return writeUnsignedInt(value);
+}
+
+Logger& Logger::operator<<(std::size_t value) {
+	LOGGER_CHECKS();
+	return writeSizet(value);
+}
+
+Logger& Logger::operator<<(ptrdiff_t value) {
+	LOGGER_CHECKS();
+	return writePtrdifft(value);
+}
+
+Logger& Logger::operator<<(float value) {
+	LOGGER_CHECKS();
+	return writeFloat(value);
+}
+
+Logger& Logger::operator<<(double value) {
+	LOGGER_CHECKS();
+	return writeDouble(value);
+}
+
+Logger& Logger::operator<<(bool value) {
+	LOGGER_CHECKS();
+	return writeBool(value);
+}
+
+Logger& Logger::operator<<(const std::filesystem::path& value) {
+	LOGGER_CHECKS();
+	return writePath(value);
+}
+
+Logger& Logger::operator<<(const LoggerFlush& value) {
+	LOGGER_CHECKS();
+	flushLineBuffer();
+	return *this;
+}
+
+void Logger::lock() {
+	loggerAssert(!locked);
+	locked = true;
+}
+
+void Logger::unlock() {
+	locked = false;
+}
+
+void Logger::manualActivate() {
+	loggerAssert(!locked);
+	manual_switch_active = true;
+}
+
+void Logger::manualDeactivate() {
+	loggerAssert(!locked);
+	manual_switch_active = false;
+}
+
+void Logger::addIndentLevel(ptrdiff_t level) {
+	loggerAssert(!locked);
+	LoggerThreadState& st = state();
+	st.indent_level += level;
+	st.indent_level = std::max((ptrdiff_t)0, st.indent_level);
+}
+
+void Logger::flush() {
+	loggerAssert(!locked);
+	// sinks can't be changed until they are flushed
+	std::unique_lock<std::mutex> lock(consumer_mutex, std::defer_lock);
+	if (thread_safe) {
+		// batches of other threads are published by those threads,
+		// unless they haven't written anything for batch_interval
+		publishBatch(state());
+		if (thread_safe_options.batch_lines > 0) {
+			publishIdleBatches(timestamp.now());
+		}
+		lock.lock();
+		drainRing();
+	}
+	internalFlush();
+	if (async_writer) {
+		async_writer->drain();
+	} else {
+		flushSinks();
+	}
+	if (binary) {
+		binary_file.flush();
+	}
+}
+
+bool Logger::getAutoFlush() const {
+	return autoflush;
+}
+
+void Logger::setAutoFlush(bool value) {
+	loggerAssert(!locked);
+	this->autoflush = value;
+}
+
+bool Logger::getActiveSwitch() const {
+	return active_switch;
+}
+
+void Logger::setActiveSwitch(bool value) {
+	loggerAssert(!locked);
+	this->active_switch = value;
+	config_generation++;
+}
+
+void Logger::enableAsync(const LoggerAsyncOptions& options) {
+	loggerAssert(!locked);
+	async_writer.reset();
+	async_writer = std::make_unique<LoggerAsyncWriter>(
+		options,
+		[this](std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos) {
+			writeToSinks(records, infos);
+		},
+		[this]() { flushSinks(); }
+	);
+}
+
+void Logger::disableAsync() {
+	loggerAssert(!locked);
+	async_writer.reset();
+}
+
+bool Logger::isAsync() const {
+	return async_writer != nullptr;
+}
+
+size_t Logger::getDroppedCount() const {
+	if (!async_writer) {
+		return 0;
+	}
+	return async_writer->getDroppedCount();
+}
+
+void Logger::addSink(std::shared_ptr<LoggerSink> sink) {
+	loggerAssert(!locked);
+	loggerAssert(sink != nullptr);
+	// producers write to sinks while holding consumer_mutex,
+	// writer thread is idle after drain
+	std::lock_guard<std::mutex> lock(consumer_mutex);
+	if (async_writer) {
+		async_writer->drain();
+	}
+	sinks.push_back(sink);
+	has_sinks = true;
+}
+
+void Logger::addSink(std::shared_ptr<LoggerSink> sink, const LoggerAsyncOptions& options) {
+	loggerAssert(!locked);
+	loggerAssert(sink != nullptr);
+	std::lock_guard<std::mutex> lock(consumer_mutex);
+	if (async_writer) {
+		async_writer->drain();
+	}
+	sink_stages.push_back(std::make_unique<LoggerSinkStage>(sink, options, shared_batch_pool));
+	has_sinks = true;
+}
+
+void Logger::removeSink(const std::shared_ptr<LoggerSink>& sink) {
+	loggerAssert(!locked);
+	std::lock_guard<std::mutex> lock(consumer_mutex);
+	if (async_writer) {
+		async_writer->drain();
+	}
+	std::erase(sinks, sink);
+	// stage writes out its queue before it stops
+	std::erase_if(sink_stages, [&](const std::unique_ptr<LoggerSinkStage>& stage) {
+		return stage->getSink() == sink;
+	});
+	has_sinks = !sinks.empty() || !sink_stages.empty();
+}
+
+void Logger::clearSinks() {
+	loggerAssert(!locked);
+	std::lock_guard<std::mutex> lock(consumer_mutex);
+	if (async_writer) {
+		async_writer->drain();
+	}
+	sinks.clear();
+	sink_stages.clear();
+	has_sinks = false;
+}
+
+const std::vector<std::shared_ptr<LoggerSink>>& Logger::getSinks() const {
+	return sinks;
+}
+
+size_t Logger::getSinkDroppedCount(const std::shared_ptr<LoggerSink>& sink) const {
+	for (const std::unique_ptr<LoggerSinkStage>& stage : sink_stages) {
+		if (stage->getSink() == sink) {
+			return stage->getDroppedCount();
+		}
+	}
+	return 0;
+}
+
+size_t Logger::getHighWaterMark() const {
+	return high_water_mark;
+}
+
+void Logger::setHighWaterMark(size_t bytes) {
+	loggerAssert(!locked);
+	high_water_mark = bytes;
+}
+
+LoggerLevel Logger::getLevel() const {
+	return level;
+}
+
+void Logger::setLevel(LoggerLevel level) {
+	loggerAssert(!locked);
+	this->level = level;
+	enabled_level = std::min(level, recorder_level);
+}
+
+void Logger::setFlightRecorder(std::shared_ptr<LoggerFlightRecorder> recorder, LoggerLevel level) {
+	loggerAssert(!locked);
+	flight_recorder = recorder;
+	recorder_level = recorder ? level : LoggerLevel::Off;
+	enabled_level = std::min(this->level.load(), recorder_level);
+}
+
+const std::shared_ptr<LoggerFlightRecorder>& Logger::getFlightRecorder() const {
+	return flight_recorder;
+}
+
+void Logger::writeSuppressedSummary() {
+	// counts are kept for a later summary if this one wouldn't be written,
+	// logger level is checked and not enabled level, lines below it go only to the flight recorder
+	bool warn_enabled = (int)LoggerLevel::Warn >= LOGGER_MIN_LEVEL && LoggerLevel::Warn >= getLevel();
+	if (!warn_enabled || !enabled()) {
+		return;
+	}
+	for (LoggerCallSite* site = LoggerCallSite::getFirst(); site; site = site->getNext()) {
+		// call site list is shared by all loggers
+		if (site->getLoggerId() != id) {
+			continue;
+		}
+		uint64_t suppressed = site->takeSuppressed();
+		if (suppressed == 0) {
+			continue;
+		}
+		std::string_view file = site->getFile();
+		size_t slash = file.find_last_of("/\\");
+		if (slash != std::string_view::npos) {
+			file.remove_prefix(slash + 1);
+		}
+		log(LoggerLevel::Warn, "Suppressed {} lines at {}:{}", (size_t)suppressed, file, site->getLine());
+	}
+}
+
+void Logger::writeSuppressedSummaryIfDue() {
+	int64_t interval = suppressed_summary_interval.load(std::memory_order_relaxed);
+	if (interval <= 0 || !state().line_buffer.empty()) {
+		return;
+	}
+	int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()
+	).count();
+	int64_t last = last_suppressed_summary.load(std::memory_order_relaxed);
+	if (last == 0) {
+		// interval starts with the first rate limited statement
+		last_suppressed_summary.compare_exchange_strong(last, now, std::memory_order_relaxed);
+		return;
+	}
+	if (now - last < interval) {
+		return;
+	}
+	// only one thread writes the summary
+	if (last_suppressed_summary.compare_exchange_strong(last, now, std::memory_order_relaxed)) {
+		writeSuppressedSummary();
+	}
+}
+
+std::chrono::milliseconds Logger::getSuppressedSummaryInterval() const {
+	return std::chrono::milliseconds(suppressed_summary_interval.load());
+}
+
+void Logger::setSuppressedSummaryInterval(std::chrono::milliseconds interval) {
+	loggerAssert(!locked);
+	suppressed_summary_interval = interval.count();
+}
+
+LoggerClock Logger::getClock() const {
+	return timestamp.getClock();
+}
+
+void Logger::setClock(LoggerClock clock) {
+	loggerAssert(!locked);
+	timestamp.setClock(clock);
+}
+
+LoggerTimePrecision Logger::getTimePrecision() const {
+	return timestamp.getPrecision();
+}
+
+void Logger::setTimePrecision(LoggerTimePrecision precision) {
+	loggerAssert(!locked);
+	timestamp.setPrecision(precision);
+}
+
+const LoggerIndentStyle& Logger::getIndentStyle() const {
+	return indent_table.getStyle();
+}
+
+void Logger::setIndentStyle(const LoggerIndentStyle& style) {
+	loggerAssert(!locked);
+	indent_table = LoggerIndentTable(style);
+}
+
+const LoggerNumberFormat& Logger::getNumberFormat() const {
+	return number_format;
+}
+
+void Logger::setNumberFormat(const LoggerNumberFormat& format) {
+	loggerAssert(!locked);
+	loggerAssert(format.precision <= LoggerFormat::MAX_PRECISION, "Precision is too large: " + std::to_string(format.precision));
+	number_format = format;
+}
+
+void Logger::enableThreadSafe(size_t ring_capacity) {
+	LoggerThreadSafeOptions options;
+	options.ring_capacity = ring_capacity;
+	enableThreadSafe(options);
+}
+
+void Logger::enableThreadSafe(const LoggerThreadSafeOptions& options) {
+	loggerAssert(!locked);
+	loggerAssert(!thread_safe, "Thread-safe mode is already enabled");
+	loggerAssert(main_state.tags.empty() && main_state.indent_level == 0 && main_state.line_buffer.empty(),
+		"Thread-safe mode must be enabled outside of all logger scopes");
+	thread_safe_options = options;
+	ring = std::make_unique<LoggerRingBuffer>(options.ring_capacity);
+	if (options.batch_lines > 0) {
+		std::lock_guard<std::mutex> lock(batchLoggersMutex());
+		batchLoggers()[id] = this;
+	}
+	thread_safe = true;
+}
+
+bool Logger::isThreadSafe() const {
+	return thread_safe;
+}
+
+bool Logger::enableBinary(const std::filesystem::path& path) {
+	loggerAssert(!locked);
+	disableBinary();
+	binary_file.open(path, std::ios::binary | std::ios::trunc);
+	if (!binary_file.is_open()) {
+		return false;
+	}
+	binary_file.write(LOGGER_BINARY_MAGIC, sizeof(LOGGER_BINARY_MAGIC) - 1);
+	uint8_t settings[] = {
+		(uint8_t)write_time,
+		(uint8_t)timestamp.getClock(),
+		(uint8_t)timestamp.getPrecision(),
+		(uint8_t)number_format.float_format,
+		number_format.precision,
+		(uint8_t)number_format.hex,
+	};
+	binary_file.write((const char*)settings, sizeof(settings));
+	std::string_view indent_unit = indent_table.getUnit();
+	uint32_t indent_unit_size = (uint32_t)indent_unit.size();
+	uint32_t indent_max_depth = (uint32_t)indent_table.getStyle().max_depth;
+	binary_file.write((const char*)&indent_unit_size, sizeof(indent_unit_size));
+	binary_file.write(indent_unit.data(), indent_unit.size());
+	binary_file.write((const char*)&indent_max_depth, sizeof(indent_max_depth));
+	// format definitions have to be written again to the new file
+	main_state.formats_written.clear();
+	{
+		std::lock_guard<std::mutex> lock(thread_states_mutex);
+		for (auto& thread_state : thread_states) {
+			thread_state->formats_written.clear();
+		}
+	}
+	binary = true;
+	return true;
+}
+
+void Logger::disableBinary() {
+	loggerAssert(!locked);
+	if (!binary) {
+		return;
 	}
+	flush();
+	binary = false;
+	binary_file.close();
 }
 
-#define loggerAssert(value, ...) \
-	_loggerAssert_print_msg(value, __VA_ARGS__); \
-	assert(value);
+bool Logger::isBinary() const {
+	return binary;
+}
 
-#else
+void Logger::disableStdWrite() {
+	std_write = false;
+}
 
-#define loggerAssert(value, ...)
+void Logger::enableStdWrite() {
+	std_write = true;
+}
 
-#endif // !NDEBUG
+const std::vector<LoggerTagHandle>& Logger::getTags() const {
+	return state().tags;
+}
 
-Logger logger;
+void Logger::pushTag(LoggerTagHandle tag) {
+	loggerAssert(!locked);
+	LoggerThreadState& st = state();
+	st.tags.push_back(tag);
+	updateActive(st);
+}
 
-Logger::Logger(bool test) {
-	if (test) {
-		test_mode = true;
-		write_time = false;
-	}
+void Logger::popTag() {
+	loggerAssert(!locked);
+	LoggerThreadState& st = state();
+	loggerAssert(!st.tags.empty());
+	st.tags.pop_back();
+	updateActive(st);
 }
 
-#define LOGGER_CHECKS() \
-	loggerAssert(!locked); \
-	if (!is_active || !manual_switch_active) { \
-		return *this; \
-	}
+bool Logger::isTagEnabled(LoggerTagHandle tag) const {
+	return tag_flags[tag.id] & TAG_ENABLED;
+}
 
-Logger& Logger::operator<<(const char* value) {
-	LOGGER_CHECKS();
-	return writeString(std::string(value));
+void Logger::setTagEnabled(LoggerTagHandle tag, bool value) {
+	setTagFlag(tag, TAG_ENABLED, value);
 }
 
-Logger& Logger::operator<<(std::string value) {
-	LOGGER_CHECKS();
-	return writeString(value);
+bool Logger::isTagDisabled(LoggerTagHandle tag) const {
+	return tag_flags[tag.id] & TAG_DISABLED;
 }
 
-Logger& Logger::operator<<(int value) {
-	LOGGER_CHECKS();
-	return writeInt(value);
+void Logger::setTagDisabled(LoggerTagHandle tag, bool value) {
+	setTagFlag(tag, TAG_DISABLED, value);
 }
 
-Logger& Logger::operator<<(unsigned int value) {
-	LOGGER_CHECKS();
-	return writeUnsignedInt(value);
+void Logger::updateAcive() {
+	loggerAssert(!locked);
+	updateActive(state());
 }
 
-Logger& Logger::operator<<(std::size_t value) {
-	LOGGER_CHECKS();
-	return writeSizet(value);
+bool Logger::isActive() {
+	LoggerThreadState& st = state();
+	if (st.config_generation != config_generation.load(std::memory_order_relaxed)) {
+		updateActive(st);
+	}
+	return st.is_active && manual_switch_active.load(std::memory_order_relaxed);
 }
 
-Logger& Logger::operator<<(ptrdiff_t value) {
-	LOGGER_CHECKS();
-	return writePtrdifft(value);
+bool Logger::enabled() {
+	return isActive();
 }
 
-Logger& Logger::operator<<(float value) {
-	LOGGER_CHECKS();
-	return writeFloat(value);
+bool Logger::enabled(const std::string& tag) const {
+	LoggerTagHandle handle;
+	if (!LoggerTagRegistry::findTag(tag, handle)) {
+		// unregistered tag can't have flags set, queries don't fill the registry
+		bool tag_active = active_switch.load(std::memory_order_relaxed);
+		return tag_active && manual_switch_active.load(std::memory_order_relaxed);
+	}
+	return enabled(handle);
 }
 
-Logger& Logger::operator<<(double value) {
-	LOGGER_CHECKS();
-	return writeDouble(value);
+const std::string& Logger::getLineBuffer() const {
+	return state().line_buffer;
 }
 
-Logger& Logger::operator<<(bool value) {
-	LOGGER_CHECKS();
-	return writeBool(value);
+const std::string& Logger::getTotalBuffer() const {
+	total_text = total_buffer.str();
+	return total_text;
 }
 
-Logger& Logger::operator<<(const std::filesystem::path& value) {
-	LOGGER_CHECKS();
-	return writePath(value);
+size_t Logger::getTotalBufferPages() const {
+	return total_buffer.getPageCount();
 }
 
-Logger& Logger::operator<<(const LoggerFlush& value) {
-	LOGGER_CHECKS();
-	flushLineBuffer();
-	return *this;
+LoggerThreadState& Logger::state() {
+	if (!thread_safe) {
+		return main_state;
+	}
+	return threadState();
 }
 
-void Logger::lock() {
-	loggerAssert(!locked);
-	locked = true;
+const LoggerThreadState& Logger::state() const {
+	return const_cast<Logger*>(this)->state();
 }
 
-void Logger::unlock() {
-	locked = false;
+LoggerThreadState& Logger::threadState() {
+	struct CacheEntry {
+		uint64_t logger_id;
+		LoggerThreadState* state;
+	};
+	// logger ids are never reused, so entries of destroyed loggers never match
+	thread_local CacheEntry last_entry = { 0, nullptr };
+	thread_local std::vector<CacheEntry> entries;
+	if (last_entry.logger_id == id) {
+		return *last_entry.state;
+	}
+	for (const CacheEntry& entry : entries) {
+		if (entry.logger_id == id) {
+			last_entry = entry;
+			return *entry.state;
+		}
+	}
+	LoggerThreadState* new_state;
+	{
+		std::lock_guard<std::mutex> lock(thread_states_mutex);
+		thread_states.push_back(std::make_unique<LoggerThreadState>());
+		new_state = thread_states.back().get();
+		new_state->thread_index = (uint32_t)thread_states.size();
+	}
+	updateActive(*new_state);
+	// misses are rare, entries of destroyed loggers are dropped on them,
+	// so the caches don't grow with every logger the thread has used
+	std::lock_guard<std::mutex> lock(liveLoggersMutex());
+	std::erase_if(entries, [](const CacheEntry& entry) {
+		return !liveLoggers().contains(entry.logger_id);
+	});
+	if (thread_safe_options.batch_lines > 0) {
+		thread_local LoggerThreadExit thread_exit;
+		std::erase_if(thread_exit.entries, [](const LoggerThreadExit::Entry& entry) {
+			return !liveLoggers().contains(entry.logger_id);
+		});
+		thread_exit.entries.push_back({ id, new_state });
+	}
+	last_entry = { id, new_state };
+	entries.push_back(last_entry);
+	return *new_state;
 }
 
-void Logger::manualActivate() {
-	loggerAssert(!locked);
-	manual_switch_active = true;
+void Logger::updateActive(LoggerThreadState& st) {
+	st.config_generation = config_generation.load(std::memory_order_relaxed);
+	if (st.tags.empty()) {
+		st.is_active = active_switch;
+		return;
+	}
+	uint8_t flags = tag_flags[st.tags.back().id].load(std::memory_order_relaxed);
+	if (active_switch) {
+		st.is_active = !(flags & TAG_DISABLED);
+	} else {
+		st.is_active = flags & TAG_ENABLED;
+	}
 }
 
-void Logger::manualDeactivate() {
+void Logger::setTagFlag(LoggerTagHandle tag, uint8_t flag, bool value) {
 	loggerAssert(!locked);
-	manual_switch_active = false;
+	if (value) {
+		tag_flags[tag.id].fetch_or(flag, std::memory_order_relaxed);
+	} else {
+		tag_flags[tag.id].fetch_and(~flag, std::memory_order_relaxed);
+	}
+	// other threads pick up the change on their next write
+	config_generation++;
+	updateActive(state());
 }
 
-void Logger::addIndentLevel(ptrdiff_t level) {
-	loggerAssert(!locked);
-	indent_level += level;
-	indent_level = std::max((ptrdiff_t)0, indent_level);
-	updateIndentStr();
+template<typename T>
+static void appendRaw(std::string& out, T value) {
+	out.append((const char*)&value, sizeof(value));
 }
 
-void Logger::flush() {
-	loggerAssert(!locked);
-	internalFlush();
+static void encodeString(std::string& out, std::string_view value) {
+	appendRaw(out, LoggerBinaryArg::String);
+	appendRaw(out, (uint32_t)value.size());
+	out += value;
 }
 
-bool Logger::getAutoFlush() const {
-	return autoflush;
+void Logger::encodeArg(std::string& out, int value) {
+	appendRaw(out, LoggerBinaryArg::Int);
+	appendRaw(out, value);
 }
 
-void Logger::setAutoFlush(bool value) {
-	loggerAssert(!locked);
-	this->autoflush = value;
+void Logger::encodeArg(std::string& out, unsigned int value) {
+	appendRaw(out, LoggerBinaryArg::UnsignedInt);
+	appendRaw(out, value);
 }
 
-bool Logger::getActiveSwitch() const {
-	return active_switch;
+void Logger::encodeArg(std::string& out, size_t value) {
+	appendRaw(out, LoggerBinaryArg::Sizet);
+	appendRaw(out, (uint64_t)value);
 }
 
-void Logger::setActiveSwitch(bool value) {
-	loggerAssert(!locked);
-	this->active_switch = value;
+void Logger::encodeArg(std::string& out, ptrdiff_t value) {
+	appendRaw(out, LoggerBinaryArg::Ptrdifft);
+	appendRaw(out, (int64_t)value);
 }
 
-void Logger::disableStdWrite() {
-	std_write = false;
+void Logger::encodeArg(std::string& out, float value) {
+	appendRaw(out, LoggerBinaryArg::Float);
+	appendRaw(out, value);
 }
 
-void Logger::enableStdWrite() {
-	std_write = true;
+void Logger::encodeArg(std::string& out, double value) {
+	appendRaw(out, LoggerBinaryArg::Double);
+	appendRaw(out, value);
 }
 
-std::vector<std::string>& Logger::getTags() {
-	loggerAssert(!locked);
-	return tags;
+void Logger::encodeArg(std::string& out, bool value) {
+	appendRaw(out, LoggerBinaryArg::Bool);
+	appendRaw(out, (uint8_t)value);
 }
 
-const std::vector<std::string>& Logger::getTags() const {
-	return tags;
+void Logger::encodeArg(std::string& out, const char* value) {
+	encodeString(out, value);
 }
 
-std::set<std::string>& Logger::getEnabledTags() {
-	loggerAssert(!locked);
-	return enabled_tags;
+void Logger::encodeArg(std::string& out, const std::string& value) {
+	encodeString(out, value);
 }
 
-const std::set<std::string>& Logger::getEnabledTags() const {
-	return enabled_tags;
+void Logger::encodeArg(std::string& out, std::string_view value) {
+	encodeString(out, value);
 }
 
-std::set<std::string>& Logger::getDisabledTags() {
-	loggerAssert(!locked);
-	return disabled_tags;
+void Logger::encodeArg(std::string& out, const std::filesystem::path& value) {
+	encodeString(out, value.string());
 }
 
-const std::set<std::string>& Logger::getDisabledTags() const {
-	return disabled_tags;
+bool Logger::recordChecks(bool ends_line) {
+	loggerAssert(!locked);
+#if LOGGER_STATS
+	LoggerThreadState& st = state();
+	if (!isActive()) {
+		countSuppressed(st, ends_line);
+		return false;
+	}
+	st.line_suppressed = false;
+	return true;
+#else
+	return isActive();
+#endif
 }
 
-void Logger::updateAcive() {
+bool Logger::recordChecks(std::string_view text) {
+#if LOGGER_STATS
 	loggerAssert(!locked);
-	if (tags.empty()) {
-		is_active = active_switch;
-		return;
+	LoggerThreadState& st = state();
+	if (!isActive()) {
+		// text is only searched when it's suppressed
+		countSuppressed(st, memchr(text.data(), '\n', text.size()) != nullptr);
+		return false;
 	}
-	std::string tag = tags.back();
-	if (active_switch) {
-		auto it = disabled_tags.find(tag);
-		bool found = it != disabled_tags.end();
-		is_active = !found;
-	} else {
-		auto it = enabled_tags.find(tag);
-		bool found = it != enabled_tags.end();
-		is_active = found;
+	st.line_suppressed = false;
+	return true;
+#else
+	return recordChecks();
+#endif
+}
+
+std::string& Logger::beginBinaryRecord(uint32_t format_id, const char* format, size_t arg_count) {
+	LoggerThreadState& st = state();
+	if (!st.line_buffer.empty()) {
+		// unfinished line goes first, record continues it
+		flushLineBuffer();
 	}
+	std::string& out = st.record_buffer;
+	out.clear();
+	if (format_id >= st.formats_written.size()) {
+		st.formats_written.resize(format_id + 1);
+	}
+	if (!st.formats_written[format_id]) {
+		// other threads might write the same definition, decoder doesn't mind
+		size_t length = strlen(format);
+		appendRaw(out, LoggerBinaryRecord::Format);
+		appendRaw(out, format_id);
+		appendRaw(out, (uint32_t)length);
+		out.append(format, length);
+		st.formats_written[format_id] = true;
+	}
+	uint8_t flags = LOGGER_BINARY_NEWLINE;
+	if (!st.new_line) {
+		flags |= LOGGER_BINARY_CONTINUATION;
+	}
+	st.line_time = std::max(st.line_time, timestamp.now());
+	writeBinaryHeader(out, LoggerBinaryRecord::Record, flags, st.line_time);
+	appendRaw(out, format_id);
+	appendRaw(out, (uint8_t)arg_count);
+	return out;
+}
+
+void Logger::endBinaryRecord() {
+	LoggerThreadState& st = state();
+	commitLine(st.record_buffer);
+	st.new_line = true;
+}
+
+void Logger::writeBinaryHeader(std::string& out, LoggerBinaryRecord type, uint8_t flags, int64_t time) {
+	const LoggerThreadState& st = state();
+	appendRaw(out, type);
+	appendRaw(out, flags);
+	appendRaw(out, time);
+	appendRaw(out, st.tags.empty() ? LOGGER_BINARY_NO_TAG : st.tags.back().id);
+	appendRaw(out, (uint32_t)st.indent_level);
+}
+
+bool Logger::writeFormatLiteral(std::string_view& format) {
+	size_t pos = format.find("{}");
+	if (pos == std::string_view::npos) {
+		writeString(format);
+		format = std::string_view();
+		return false;
+	}
+	writeString(format.substr(0, pos));
+	format.remove_prefix(pos + 2);
+	return true;
 }
 
-const std::string& Logger::getLineBuffer() const {
-	return line_buffer;
+void Logger::appendArg(std::string& out, int value) {
+	LoggerFormat::append(out, value, number_format);
 }
 
-const std::string& Logger::getTotalBuffer() const {
-	return total_buffer;
+void Logger::appendArg(std::string& out, unsigned int value) {
+	LoggerFormat::append(out, value, number_format);
 }
 
-std::vector<std::string> Logger::splitString(const std::string& str) {
-	std::vector<std::string> results;
-	std::string current_word;
-	for (size_t i = 0; i < str.size() + 1; i++) {
-		char c;
-		if (i < str.size()) {
-			c = str[i];
-		} else {
-			c = EOF;
-		}
-		if (c == '\n' || c == EOF) {
-			if (current_word.size() > 0) {
-				results.push_back(current_word);
-			}
-			if (c == '\n') {
-				results.push_back("\n");
-			}
-			current_word = "";
-		} else {
-			current_word += c;
-		}
-	}
-	return results;
+void Logger::appendArg(std::string& out, size_t value) {
+	LoggerFormat::append(out, value, number_format);
+}
+
+void Logger::appendArg(std::string& out, ptrdiff_t value) {
+	LoggerFormat::append(out, value, number_format);
+}
+
+void Logger::appendArg(std::string& out, float value) {
+	LoggerFormat::append(out, value, number_format);
+}
+
+void Logger::appendArg(std::string& out, double value) {
+	LoggerFormat::append(out, value, number_format);
+}
+
+void Logger::appendArg(std::string& out, bool value) {
+	out += boolToStr(value);
+}
+
+void Logger::appendArg(std::string& out, const char* value) {
+	out += value;
+}
+
+void Logger::appendArg(std::string& out, const std::string& value) {
+	out += value;
+}
+
+void Logger::appendArg(std::string& out, std::string_view value) {
+	out += value;
+}
+
+void Logger::appendArg(std::string& out, const std::filesystem::path& value) {
+	out += value.string();
 }
 
-std::string Logger::currentTime() {
-	time_t t;
-	std::time(&t);
-	tm l;
-	localtime_s(&l, &t);
-	std::stringstream ss;
-	ss << std::setw(2) << std::setfill('0') << l.tm_hour;
-	ss << ":" << std::setw(2) << std::setfill('0') << l.tm_min;
-	ss << ":" << std::setw(2) << std::setfill('0') << l.tm_sec;
-	return ss.str();
+Logger& Logger::endFormattedLine(size_t start, size_t content_start, bool new_line) {
+	LoggerThreadState& st = state();
+	std::string& line = st.line_buffer;
+	bool has_newline = memchr(line.data() + content_start, '\n', line.size() - content_start) != nullptr;
+	if (has_newline || line.size() == content_start) {
+		// rare, text is taken back out and goes through writeString,
+		// so that every line gets its own prefix and empty lines get none
+		std::string& text = st.format_buffer;
+		text.assign(line, content_start);
+		line.resize(start);
+		st.new_line = new_line;
+		writeString(text);
+	}
+	return writeNewLine();
 }
 
-std::string Logger::boolToStr(bool value) {
+const char* Logger::boolToStr(bool value) {
 	return value ? "true" : "false";
 }
 
-Logger& Logger::writeString(std::string value) {
-	std::vector<std::string> lines = splitString(value);
-	for (size_t i = 0; i < lines.size(); i++) {
-		std::string line = lines[i];
-		if (line == "\n") {
-			writeNewLine();
-		} else {
-			writeToLineBuffer(line);
+Logger& Logger::writeString(std::string_view value) {
+	// newlines are found in place, fragments are copied straight into the line buffer
+	while (!value.empty()) {
+		const char* newline = (const char*)memchr(value.data(), '\n', value.size());
+		if (!newline) {
+			writeToLineBuffer(value);
+			break;
+		}
+		size_t length = newline - value.data();
+		if (length > 0) {
+			writeToLineBuffer(value.substr(0, length));
 		}
+		writeNewLine();
+		value.remove_prefix(length + 1);
 	}
 	return *this;
 }
 
-Logger& Logger::writeToLineBuffer(std::string value) {
-	if (new_line) {
+Logger& Logger::writeToLineBuffer(std::string_view value) {
+	LoggerThreadState& st = state();
+	bool batched = thread_safe && thread_safe_options.batch_lines > 0;
+	if (st.line_buffer.empty() && (binary || batched || write_time || OnBatchWrite || has_sinks)) {
+		// batches are merged by this time, it never goes back within a thread
+		st.line_time = std::max(st.line_time, timestamp.now());
+		st.line_continues = !st.new_line;
+	}
+	if (!binary && st.new_line) {
+		// in binary mode prefix is restored by the decoder
 		if (write_time) {
-			std::string current_time = currentTime();
-			line_buffer += "[" + current_time + "] ";
+			timestamp.write(st.line_buffer, st.line_time);
+		}
+		if (thread_safe && thread_safe_options.thread_prefix) {
+			st.line_buffer += "[T";
+			LoggerFormat::append(st.line_buffer, st.thread_index);
+			st.line_buffer += "] ";
 		}
-		line_buffer += indent_str;
+		indent_table.append(st.line_buffer, st.indent_level);
 	}
-	line_buffer += value;
-	new_line = false;
+	st.line_buffer += value;
+	st.new_line = false;
 	return *this;
 }
 
 Logger& Logger::writeNewLine() {
 	flushLineBuffer(true);
-	new_line = true;
+	state().new_line = true;
 	return *this;
 }
 
 Logger& Logger::writeInt(int value) {
-	return writeString(std::to_string(value));
+	char buffer[LoggerFormat::MAX_NUMBER_LENGTH];
+	return writeString(LoggerFormat::format(buffer, value, number_format));
 }
 
 Logger& Logger::writeUnsignedInt(unsigned int value) {
-	return writeString(std::to_string(value));
+	char buffer[LoggerFormat::MAX_NUMBER_LENGTH];
+	return writeString(LoggerFormat::format(buffer, value, number_format));
 }
 
 Logger& Logger::writeInt(float value) {
@@ -296,19 +1975,23 @@ Logger& Logger::writeInt(double value) {
 }
 
 Logger& Logger::writeSizet(std::size_t value) {
-	return writeString(std::to_string(value));
+	char buffer[LoggerFormat::MAX_NUMBER_LENGTH];
+	return writeString(LoggerFormat::format(buffer, value, number_format));
 }
 
 Logger& Logger::writePtrdifft(ptrdiff_t value) {
-	return writeString(std::to_string(value));
+	char buffer[LoggerFormat::MAX_NUMBER_LENGTH];
+	return writeString(LoggerFormat::format(buffer, value, number_format));
 }
 
 Logger& Logger::writeFloat(float value) {
-	return writeString(std::to_string(value));
+	char buffer[LoggerFormat::MAX_NUMBER_LENGTH];
+	return writeString(LoggerFormat::format(buffer, value, number_format));
 }
 
 Logger& Logger::writeDouble(double value) {
-	return writeString(std::to_string(value));
+	char buffer[LoggerFormat::MAX_NUMBER_LENGTH];
+	return writeString(LoggerFormat::format(buffer, value, number_format));
 }
 
 Logger& Logger::writeBool(bool value) {
@@ -319,33 +2002,322 @@ Logger& Logger::writePath(const std::filesystem::path& value) {
 	return writeString(value.string());
 }
 
-void Logger::updateIndentStr() {
-	indent_str = "";
-	for (size_t i = 0; (ptrdiff_t)i < indent_level; i++) {
-		indent_str += "|   ";
+void Logger::internalFlush() {
+#if LOGGER_STATS
+	uint64_t start = statNow();
+#endif
+	std::span<const std::string_view> pending(records.begin() + flushed_records, records.end());
+	std::span<const LoggerRecordInfo> pending_infos(record_infos.begin() + flushed_records, record_infos.end());
+	if (OnBatchWrite && !pending.empty()) {
+		OnBatchWrite(pending, pending_infos);
+	}
+	if (binary) {
+		for (std::string_view record : pending) {
+			binary_file.write(record.data(), record.size());
+		}
+	} else if (!pending.empty()) {
+		if (!sink_stages.empty()) {
+			// one copy for all stages, no matter how many there are
+			LoggerSharedBatch* batch = shared_batch_pool.take(sink_stages.size());
+			for (std::string_view record : pending) {
+				batch->text += record;
+			}
+			size_t offset = 0;
+			for (std::string_view record : pending) {
+				batch->records.push_back(std::string_view(batch->text).substr(offset, record.size()));
+				offset += record.size();
+			}
+			batch->infos.assign(pending_infos.begin(), pending_infos.end());
+			for (const std::unique_ptr<LoggerSinkStage>& stage : sink_stages) {
+				stage->push(batch);
+			}
+		}
+		if (!sinks.empty() || (sink_stages.empty() && std_write)) {
+			if (async_writer) {
+				async_writer->push(pending, pending_infos);
+			} else {
+				writeToSinks(pending, pending_infos);
+			}
+		}
+	}
+	pending_size = 0;
+	if (test_mode) {
+		flushed_records = records.size();
+	} else {
+		// pages go back to the pool
+		total_buffer.clear();
+		records.clear();
+		record_infos.clear();
+		flushed_records = 0;
+	}
+#if LOGGER_STATS
+	uint64_t duration = statNow() - start;
+	LoggerThreadStats& stats = state().stats;
+	statAdd(stats.flushes, 1);
+	statAdd(stats.flush_ns, duration);
+	statAdd(stats.flush_latency[LoggerLatencyHistogram::bucketIndex(duration)], 1);
+#endif
+}
+
+void Logger::writeToSinks(std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos) {
+	if (sinks.empty()) {
+		for (std::string_view record : records) {
+			std::cout << record;
+		}
+		return;
+	}
+	for (const std::shared_ptr<LoggerSink>& sink : sinks) {
+		sink->write(records, infos);
 	}
 }
 
-void Logger::internalFlush() {
-	if (std_write) {
-		std::cout << total_buffer;
+void Logger::flushSinks() {
+	for (const std::unique_ptr<LoggerSinkStage>& stage : sink_stages) {
+		stage->drain();
+	}
+	if (sinks.empty()) {
+		if (!sink_stages.empty()) {
+			return;
+		}
+		std::cout.flush();
+		return;
 	}
-	if (!test_mode) {
-		total_buffer = "";
+	for (const std::shared_ptr<LoggerSink>& sink : sinks) {
+		sink->flush();
 	}
 }
 
 void Logger::flushLineBuffer(bool write_newline) {
-	OnLineWrite(line_buffer);
-	if (write_newline) {
-		line_buffer += "\n";
+	LoggerThreadState& st = state();
+#if LOGGER_STATS
+	uint64_t start = statNow();
+#endif
+	if (OnLineWrite && st.line_level >= level.load(std::memory_order_relaxed)) {
+		if (thread_safe) {
+			std::lock_guard<std::mutex> lock(line_write_mutex);
+			OnLineWrite(st.line_buffer);
+		} else {
+			OnLineWrite(st.line_buffer);
+		}
+	}
+	if (binary) {
+		uint8_t flags = 0;
+		if (write_newline) {
+			flags |= LOGGER_BINARY_NEWLINE;
+		}
+		if (st.line_continues) {
+			flags |= LOGGER_BINARY_CONTINUATION;
+		}
+		if (st.line_buffer.empty()) {
+			st.line_time = std::max(st.line_time, timestamp.now());
+			st.line_continues = !st.new_line;
+		}
+		st.record_buffer.clear();
+		writeBinaryHeader(st.record_buffer, LoggerBinaryRecord::Line, flags, st.line_time);
+		appendRaw(st.record_buffer, (uint32_t)st.line_buffer.size());
+		st.record_buffer += st.line_buffer;
+		commitLine(st.record_buffer);
+	} else {
+		if (st.line_buffer.empty() && ((thread_safe && thread_safe_options.batch_lines > 0) || OnBatchWrite || has_sinks)) {
+			// empty line, time wasn't taken in writeToLineBuffer
+			st.line_time = std::max(st.line_time, timestamp.now());
+		}
+		if (write_newline) {
+			st.line_buffer += "\n";
+		}
+		commitLine(st.line_buffer);
+	}
+	st.new_line = false;
+	st.line_buffer.clear();
+#if LOGGER_STATS
+	statAdd(st.stats.line_flush_ns, statNow() - start);
+#endif
+}
+
+LoggerRecordInfo Logger::recordInfo(const LoggerThreadState& st) const {
+	LoggerRecordInfo info;
+	info.time = st.line_time;
+	if (!st.tags.empty()) {
+		info.tag = st.tags.back();
+	}
+	info.indent_level = (uint32_t)st.indent_level;
+	info.thread_index = st.thread_index;
+	return info;
+}
+
+void Logger::commitLine(const std::string& line) {
+	if (flight_recorder) {
+		LoggerLevel line_level = state().line_level;
+		if (!binary && line_level >= recorder_level) {
+			flight_recorder->write(line);
+		}
+		if (line_level < level.load(std::memory_order_relaxed)) {
+			return;
+		}
+	}
+#if LOGGER_STATS
+	LoggerThreadState& st = state();
+	statAdd(st.stats.lines, 1);
+	statAdd(st.stats.bytes, line.size());
+#endif
+	if (thread_safe && thread_safe_options.batch_lines > 0) {
+		appendToBatch(state(), line);
+	} else if (thread_safe) {
+		LoggerRecordInfo info = recordInfo(state());
+		publishLine(std::string_view((const char*)&info, sizeof(info)), line);
+		if (autoflush) {
+			consumeRing();
+		}
+	} else {
+		storeRecord(line, recordInfo(main_state));
+		if (autoflush) {
+			internalFlush();
+		}
+	}
+}
+
+void Logger::storeRecord(std::string_view record, const LoggerRecordInfo& info) {
+	records.push_back(total_buffer.append(record));
+	record_infos.push_back(info);
+	pending_size += record.size();
+	if (!autoflush && high_water_mark > 0 && pending_size >= high_water_mark) {
+		// spill early instead of growing without limit
+		internalFlush();
+	}
+}
+
+void Logger::publishLine(std::string_view head, std::string_view line) {
+	while (!ring->tryPush(head, line)) {
+		// ring is full, move its contents to total_buffer
+		std::lock_guard<std::mutex> lock(consumer_mutex);
+		drainRing();
+	}
+}
+
+void Logger::appendToBatch(LoggerThreadState& st, const std::string& line) {
+	int64_t interval = thread_safe_options.batch_interval.count();
+	bool published = false;
+	{
+		// lock is only contended when another thread publishes an idle batch
+		std::lock_guard<std::mutex> lock(st.batch_mutex);
+		if (st.batch_lines == 0) {
+			st.batch_time = st.line_time;
+		}
+		appendRaw(st.batch, recordInfo(st));
+		appendRaw(st.batch, (uint32_t)line.size());
+		st.batch += line;
+		st.batch_lines++;
+		if (st.batch_lines >= thread_safe_options.batch_lines || st.line_time - st.batch_time >= interval) {
+			published = pushBatch(st);
+		}
+	}
+	if (published && autoflush) {
+		consumeRing();
+	}
+	// threads that stopped writing don't publish their batches, so writing threads do it for them
+	int64_t last_search = idle_batches_time.load(std::memory_order_relaxed);
+	if (st.line_time - last_search >= interval && idle_batches_time.compare_exchange_strong(last_search, st.line_time)) {
+		publishIdleBatches(st.line_time);
+	}
+}
+
+void Logger::publishBatch(LoggerThreadState& st) {
+	bool published;
+	{
+		std::lock_guard<std::mutex> lock(st.batch_mutex);
+		published = pushBatch(st);
+	}
+	if (published && autoflush) {
+		consumeRing();
+	}
+}
+
+bool Logger::pushBatch(LoggerThreadState& st) {
+	// batch_mutex of st has to be locked, consumer_mutex must not be,
+	// it's needed if the ring is full
+	if (st.batch_lines == 0) {
+		return false;
+	}
+	publishLine(std::string_view(), st.batch);
+	st.batch.clear();
+	st.batch_lines = 0;
+	return true;
+}
+
+void Logger::publishIdleBatches(int64_t now) {
+	// thread_states_mutex isn't held while publishing, states are never removed
+	bool published = false;
+	for (size_t i = 0; ; i++) {
+		LoggerThreadState* st;
+		{
+			std::lock_guard<std::mutex> lock(thread_states_mutex);
+			if (i >= thread_states.size()) {
+				break;
+			}
+			st = thread_states[i].get();
+		}
+		std::lock_guard<std::mutex> lock(st->batch_mutex);
+		if (st->batch_lines > 0 && now - st->batch_time >= thread_safe_options.batch_interval.count()) {
+			published |= pushBatch(*st);
+		}
+	}
+	if (published && autoflush) {
+		consumeRing();
+	}
+}
+
+void Logger::drainBatches() {
+	// consumer_mutex has to be locked,
+	// lines of each thread are in order and their times never go back,
+	// so a stable sort by time interleaves threads without reordering any of them
+	merge_text.clear();
+	merge_lines.clear();
+	while (const std::string* batch = ring->peek()) {
+		size_t base = merge_text.size();
+		merge_text += *batch;
+		ring->pop();
+		size_t pos = base;
+		while (pos < merge_text.size()) {
+			MergeLine line;
+			uint32_t size;
+			memcpy(&line.info, merge_text.data() + pos, sizeof(line.info));
+			memcpy(&size, merge_text.data() + pos + sizeof(line.info), sizeof(size));
+			line.offset = pos + sizeof(line.info) + sizeof(size);
+			line.size = size;
+			merge_lines.push_back(line);
+			pos = line.offset + size;
+		}
+	}
+	std::stable_sort(merge_lines.begin(), merge_lines.end(), [](const MergeLine& a, const MergeLine& b) {
+		return a.info.time < b.info.time;
+	});
+	for (const MergeLine& line : merge_lines) {
+		storeRecord(std::string_view(merge_text).substr(line.offset, line.size), line.info);
+	}
+}
+
+void Logger::drainRing() {
+	// consumer_mutex has to be locked
+	if (thread_safe_options.batch_lines > 0) {
+		drainBatches();
+		return;
+	}
+	while (const std::string* entry = ring->peek()) {
+		LoggerRecordInfo info;
+		memcpy(&info, entry->data(), sizeof(info));
+		storeRecord(std::string_view(*entry).substr(sizeof(info)), info);
+		ring->pop();
 	}
-	total_buffer += line_buffer;
-	if (autoflush) {
+}
+
+void Logger::consumeRing() {
+	// producers never wait for the consumer, whoever gets the lock writes
+	// everything out and checks again after releasing it
+	while (!ring->empty() && consumer_mutex.try_lock()) {
+		drainRing();
 		internalFlush();
+		consumer_mutex.unlock();
 	}
-	new_line = false;
-	line_buffer = "";
 }
 
 void LoggerControl::close() {
@@ -430,10 +2402,18 @@ void LoggerDeactivate::action() {
 }
 
 LoggerTag::LoggerTag(const std::string& tag) : m_logger(logger) {
-	action(tag);
+	action(LoggerTagRegistry::registerTag(tag));
 }
 
 LoggerTag::LoggerTag(Logger& p_logger, const std::string& tag) : m_logger(p_logger) {
+	action(LoggerTagRegistry::registerTag(tag));
+}
+
+LoggerTag::LoggerTag(LoggerTagHandle tag) : m_logger(logger) {
+	action(tag);
+}
+
+LoggerTag::LoggerTag(Logger& p_logger, LoggerTagHandle tag) : m_logger(p_logger) {
 	action(tag);
 }
 
@@ -442,20 +2422,26 @@ LoggerTag::~LoggerTag() {
 }
 
 void LoggerTag::internalClose() {
-	m_logger.getTags().pop_back();
-	m_logger.updateAcive();
+	m_logger.popTag();
 }
 
-void LoggerTag::action(const std::string& tag) {
-	m_logger.getTags().push_back(tag);
-	m_logger.updateAcive();
+void LoggerTag::action(LoggerTagHandle tag) {
+	m_logger.pushTag(tag);
 }
 
 LoggerEnableTag::LoggerEnableTag(const std::string& tag) : m_logger(logger) {
-	action(tag);
+	action(LoggerTagRegistry::registerTag(tag));
 }
 
 LoggerEnableTag::LoggerEnableTag(Logger& p_logger, const std::string& tag) : m_logger(p_logger) {
+	action(LoggerTagRegistry::registerTag(tag));
+}
+
+LoggerEnableTag::LoggerEnableTag(LoggerTagHandle tag) : m_logger(logger) {
+	action(tag);
+}
+
+LoggerEnableTag::LoggerEnableTag(Logger& p_logger, LoggerTagHandle tag) : m_logger(p_logger) {
 	action(tag);
 }
 
@@ -464,21 +2450,27 @@ LoggerEnableTag::~LoggerEnableTag() {
 }
 
 void LoggerEnableTag::internalClose() {
-	m_logger.getEnabledTags().erase(tag);
-	m_logger.updateAcive();
+	m_logger.setTagEnabled(tag, false);
 }
 
-void LoggerEnableTag::action(const std::string& tag) {
+void LoggerEnableTag::action(LoggerTagHandle tag) {
 	this->tag = tag;
-	m_logger.getEnabledTags().insert(tag);
-	m_logger.updateAcive();
+	m_logger.setTagEnabled(tag, true);
 }
 
 LoggerDisableTag::LoggerDisableTag(const std::string& tag) : m_logger(logger) {
-	action(tag);
+	action(LoggerTagRegistry::registerTag(tag));
 }
 
 LoggerDisableTag::LoggerDisableTag(Logger& p_logger, const std::string& tag) : m_logger(p_logger) {
+	action(LoggerTagRegistry::registerTag(tag));
+}
+
+LoggerDisableTag::LoggerDisableTag(LoggerTagHandle tag) : m_logger(logger) {
+	action(tag);
+}
+
+LoggerDisableTag::LoggerDisableTag(Logger& p_logger, LoggerTagHandle tag) : m_logger(p_logger) {
 	action(tag);
 }
 
@@ -487,12 +2479,10 @@ LoggerDisableTag::~LoggerDisableTag() {
 }
 
 void LoggerDisableTag::internalClose() {
-	m_logger.getDisabledTags().erase(tag);
-	m_logger.updateAcive();
+	m_logger.setTagDisabled(tag, false);
 }
 
-void LoggerDisableTag::action(const std::string& tag) {
+void LoggerDisableTag::action(LoggerTagHandle tag) {
 	this->tag = tag;
-	m_logger.getDisabledTags().insert(tag);
-	m_logger.updateAcive();
+	m_logger.setTagDisabled(tag, true);
 }
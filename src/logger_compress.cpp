@@ -0,0 +1,193 @@
+#include "logger_compress.h"
+#include <cstring>
+
+template<typename T>
+static bool readRaw(std::istream& input, T& value) {
+	input.read((char*)&value, sizeof(value));
+	return (size_t)input.gcount() == sizeof(value);
+}
+
+static uint32_t load32(const char* ptr) {
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+void LoggerBlockCodec::appendLength(std::string& out, size_t length) {
+	while (length >= 255) {
+		out += (char)255;
+		length -= 255;
+	}
+	out += (char)length;
+}
+
+size_t LoggerBlockCodec::compress(std::string_view src, std::string& out) {
+	size_t start = out.size();
+	// blocks are independent, positions of the previous block are forgotten
+	table.assign((size_t)1 << HASH_BITS, 0);
+	const char* data = src.data();
+	size_t size = src.size();
+	size_t anchor = 0;
+	auto appendSequence = [&](size_t literal_end, size_t offset, size_t match_length) {
+		size_t literal_length = literal_end - anchor;
+		size_t match_code = match_length > 0 ? match_length - MIN_MATCH : 0;
+		out += (char)((std::min<size_t>(literal_length, 15) << 4) | std::min<size_t>(match_code, 15));
+		if (literal_length >= 15) {
+			appendLength(out, literal_length - 15);
+		}
+		out.append(data + anchor, literal_length);
+		if (match_length > 0) {
+			out += (char)(offset & 0xFF);
+			out += (char)(offset >> 8);
+			if (match_code >= 15) {
+				appendLength(out, match_code - 15);
+			}
+		}
+	};
+	size_t pos = 0;
+	while (pos + MIN_MATCH <= size) {
+		uint32_t sequence = load32(data + pos);
+		uint32_t& entry = table[(sequence * 2654435761u) >> (32 - HASH_BITS)];
+		size_t candidate = entry;
+		entry = (uint32_t)(pos + 1);
+		if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET || load32(data + candidate - 1) != sequence) {
+			// skip faster through data that doesn't compress
+			pos += 1 + ((pos - anchor) >> 6);
+			continue;
+		}
+		size_t match = candidate - 1;
+		size_t length = MIN_MATCH;
+		while (pos + length < size && data[match + length] == data[pos + length]) {
+			length++;
+		}
+		appendSequence(pos, pos - match, length);
+		pos += length;
+		anchor = pos;
+	}
+	// last sequence has literals only
+	appendSequence(size, 0, 0);
+	return out.size() - start;
+}
+
+bool LoggerBlockCodec::decompress(std::string_view src, char* dst, size_t dst_size) {
+	const uint8_t* in = (const uint8_t*)src.data();
+	const uint8_t* end = in + src.size();
+	size_t out = 0;
+	auto readLength = [&](size_t& length) {
+		while (true) {
+			if (in == end) {
+				return false;
+			}
+			uint8_t byte = *in++;
+			length += byte;
+			if (byte != 255) {
+				return true;
+			}
+		}
+	};
+	while (in < end) {
+		uint8_t token = *in++;
+		size_t literal_length = token >> 4;
+		if (literal_length == 15 && !readLength(literal_length)) {
+			return false;
+		}
+		if ((size_t)(end - in) < literal_length || dst_size - out < literal_length) {
+			return false;
+		}
+		memcpy(dst + out, in, literal_length);
+		in += literal_length;
+		out += literal_length;
+		if (in == end) {
+			break;
+		}
+		if (end - in < 2) {
+			return false;
+		}
+		size_t offset = in[0] | ((size_t)in[1] << 8);
+		in += 2;
+		size_t match_length = token & 15;
+		if (match_length == 15 && !readLength(match_length)) {
+			return false;
+		}
+		match_length += MIN_MATCH;
+		if (offset == 0 || offset > out || dst_size - out < match_length) {
+			return false;
+		}
+		const char* match = dst + out - offset;
+		if (offset >= match_length) {
+			memcpy(dst + out, match, match_length);
+		} else {
+			// overlapping match repeats the last offset bytes
+			for (size_t i = 0; i < match_length; i++) {
+				dst[out + i] = match[i];
+			}
+		}
+		out += match_length;
+	}
+	return out == dst_size;
+}
+
+bool LoggerDecompressor::decompress(std::istream& input, std::ostream& output) {
+	error.clear();
+	const size_t magic_size = sizeof(LOGGER_COMPRESSED_MAGIC) - 1;
+	char magic[magic_size];
+	input.read(magic, magic_size);
+	if ((size_t)input.gcount() != magic_size || memcmp(magic, LOGGER_COMPRESSED_MAGIC, magic_size) != 0) {
+		return fail("Not a compressed log");
+	}
+	while (true) {
+		uint8_t type;
+		if (!readRaw(input, type)) {
+			break;
+		}
+		if (type == (uint8_t)LOGGER_COMPRESSED_MAGIC[0]) {
+			// start of an appended stream
+			magic[0] = (char)type;
+			input.read(magic + 1, magic_size - 1);
+			if ((size_t)input.gcount() != magic_size - 1 || memcmp(magic, LOGGER_COMPRESSED_MAGIC, magic_size) != 0) {
+				return fail("Corrupted stream header");
+			}
+			continue;
+		}
+		uint32_t raw_size;
+		uint32_t payload_size;
+		if (!readRaw(input, raw_size) || !readRaw(input, payload_size)) {
+			return fail("Truncated block header");
+		}
+		if (raw_size > LoggerBlockCodec::MAX_BLOCK_SIZE || payload_size > LoggerBlockCodec::MAX_BLOCK_SIZE * 2) {
+			return fail("Block too large: " + std::to_string(raw_size));
+		}
+		payload.resize(payload_size);
+		input.read(payload.data(), payload_size);
+		if ((size_t)input.gcount() != payload_size) {
+			return fail("Truncated block");
+		}
+		switch ((LoggerBlockType)type) {
+			case LoggerBlockType::Stored:
+				if (payload_size != raw_size) {
+					return fail("Corrupted stored block");
+				}
+				output.write(payload.data(), payload_size);
+				break;
+			case LoggerBlockType::Compressed:
+				block.resize(raw_size);
+				if (!LoggerBlockCodec::decompress(payload, block.data(), raw_size)) {
+					return fail("Corrupted compressed block");
+				}
+				output.write(block.data(), raw_size);
+				break;
+			default:
+				return fail("Unknown block type: " + std::to_string((int)type));
+		}
+	}
+	return true;
+}
+
+const std::string& LoggerDecompressor::getError() const {
+	return error;
+}
+
+bool LoggerDecompressor::fail(const std::string& message) {
+	error = message;
+	return false;
+}
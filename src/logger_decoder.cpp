@@ -0,0 +1,207 @@
+#include "logger_decoder.h"
+#include <cstring>
+#include <algorithm>
+
+template<typename T>
+static bool readRaw(std::istream& input, T& value) {
+	input.read((char*)&value, sizeof(value));
+	return (size_t)input.gcount() == sizeof(value);
+}
+
+static bool readString(std::istream& input, std::string& out) {
+	uint32_t length;
+	if (!readRaw(input, length)) {
+		return false;
+	}
+	size_t offset = out.size();
+	out.resize(offset + length);
+	input.read(out.data() + offset, length);
+	return (size_t)input.gcount() == length;
+}
+
+bool LoggerBinaryDecoder::decode(std::istream& input, std::ostream& output) {
+	error.clear();
+	formats.clear();
+	if (!readHeader(input)) {
+		return false;
+	}
+	while (true) {
+		LoggerBinaryRecord type;
+		if (!readRaw(input, type)) {
+			break;
+		}
+		bool ok;
+		switch (type) {
+			case LoggerBinaryRecord::Format:
+				ok = readFormat(input);
+				break;
+			case LoggerBinaryRecord::Line:
+			case LoggerBinaryRecord::Record:
+				ok = readLine(input, type, output);
+				break;
+			default:
+				return fail("Unknown record type: " + std::to_string((int)type));
+		}
+		if (!ok) {
+			return false;
+		}
+	}
+	return true;
+}
+
+const std::string& LoggerBinaryDecoder::getError() const {
+	return error;
+}
+
+bool LoggerBinaryDecoder::fail(const std::string& message) {
+	error = message;
+	return false;
+}
+
+bool LoggerBinaryDecoder::readHeader(std::istream& input) {
+	char magic[sizeof(LOGGER_BINARY_MAGIC) - 1];
+	input.read(magic, sizeof(magic));
+	if ((size_t)input.gcount() != sizeof(magic) || memcmp(magic, LOGGER_BINARY_MAGIC, sizeof(magic)) != 0) {
+		return fail("Not a binary log");
+	}
+	uint8_t settings[6];
+	input.read((char*)settings, sizeof(settings));
+	if ((size_t)input.gcount() != sizeof(settings)) {
+		return fail("Truncated header");
+	}
+	write_time = settings[0];
+	timestamp.setClock((LoggerClock)settings[1]);
+	timestamp.setPrecision((LoggerTimePrecision)settings[2]);
+	number_format.float_format = (LoggerFloatFormat)settings[3];
+	number_format.precision = (uint8_t)std::min<int>(settings[4], LoggerFormat::MAX_PRECISION);
+	number_format.hex = settings[5];
+	LoggerIndentStyle indent_style;
+	indent_style.glyph.clear();
+	uint32_t indent_max_depth;
+	if (!readString(input, indent_style.glyph) || !readRaw(input, indent_max_depth)) {
+		return fail("Truncated header");
+	}
+	indent_style.width = indent_style.glyph.size();
+	indent_style.max_depth = indent_max_depth;
+	indent_table = LoggerIndentTable(indent_style);
+	return true;
+}
+
+bool LoggerBinaryDecoder::readFormat(std::istream& input) {
+	uint32_t id;
+	std::string format;
+	if (!readRaw(input, id) || !readString(input, format)) {
+		return fail("Truncated format record");
+	}
+	formats[id] = format;
+	return true;
+}
+
+bool LoggerBinaryDecoder::readLine(std::istream& input, LoggerBinaryRecord type, std::ostream& output) {
+	uint8_t flags;
+	int64_t time;
+	uint32_t tag;
+	uint32_t indent;
+	if (!readRaw(input, flags) || !readRaw(input, time) || !readRaw(input, tag) || !readRaw(input, indent)) {
+		return fail("Truncated record");
+	}
+	text.clear();
+	if (type == LoggerBinaryRecord::Line) {
+		if (!readString(input, text)) {
+			return fail("Truncated line");
+		}
+	} else {
+		uint32_t format_id;
+		uint8_t arg_count;
+		if (!readRaw(input, format_id) || !readRaw(input, arg_count)) {
+			return fail("Truncated record");
+		}
+		auto it = formats.find(format_id);
+		if (it == formats.end()) {
+			return fail("Unknown format id: " + std::to_string(format_id));
+		}
+		std::string_view format = it->second;
+		for (uint8_t i = 0; i < arg_count; i++) {
+			LoggerFormat::appendLiteral(text, format);
+			if (!readArg(input)) {
+				return false;
+			}
+		}
+		text += format;
+	}
+	// same layout as Logger::writeToLineBuffer
+	line.clear();
+	if (!text.empty() && !(flags & LOGGER_BINARY_CONTINUATION)) {
+		if (write_time) {
+			timestamp.write(line, time);
+		}
+		indent_table.append(line, indent);
+	}
+	line += text;
+	if (flags & LOGGER_BINARY_NEWLINE) {
+		line += '\n';
+	}
+	output << line;
+	return true;
+}
+
+bool LoggerBinaryDecoder::readArg(std::istream& input) {
+	LoggerBinaryArg type;
+	if (!readRaw(input, type)) {
+		return fail("Truncated argument");
+	}
+	bool ok = true;
+	switch (type) {
+		case LoggerBinaryArg::Int: {
+			int value;
+			ok = readRaw(input, value);
+			LoggerFormat::append(text, value, number_format);
+			break;
+		}
+		case LoggerBinaryArg::UnsignedInt: {
+			unsigned int value;
+			ok = readRaw(input, value);
+			LoggerFormat::append(text, value, number_format);
+			break;
+		}
+		case LoggerBinaryArg::Sizet: {
+			uint64_t value;
+			ok = readRaw(input, value);
+			LoggerFormat::append(text, (size_t)value, number_format);
+			break;
+		}
+		case LoggerBinaryArg::Ptrdifft: {
+			int64_t value;
+			ok = readRaw(input, value);
+			LoggerFormat::append(text, (ptrdiff_t)value, number_format);
+			break;
+		}
+		case LoggerBinaryArg::Float: {
+			float value;
+			ok = readRaw(input, value);
+			LoggerFormat::append(text, value, number_format);
+			break;
+		}
+		case LoggerBinaryArg::Double: {
+			double value;
+			ok = readRaw(input, value);
+			LoggerFormat::append(text, value, number_format);
+			break;
+		}
+		case LoggerBinaryArg::Bool: {
+			uint8_t value;
+			ok = readRaw(input, value);
+			LoggerFormat::append(text, (bool)value);
+			break;
+		}
+		case LoggerBinaryArg::String:
+			ok = readString(input, text);
+			break;
+		default:
+			return fail("Unknown argument type: " + std::to_string((int)type));
+	}
+	if (!ok) {
+		return fail("Truncated argument");
+	}
+	return true;
+}
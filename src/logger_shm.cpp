@@ -0,0 +1,187 @@
+#include "logger_shm.h"
+#include <algorithm>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// <prefix>.<pid>.<n>, so that segments of prefix.worker don't match prefix
+static bool isSegmentName(std::string_view name, std::string_view prefix) {
+	auto isNumber = [](std::string_view str) {
+		return !str.empty() && std::all_of(str.begin(), str.end(), [](char c) { return c >= '0' && c <= '9'; });
+	};
+	if (name.size() <= prefix.size() || !name.starts_with(prefix) || name[prefix.size()] != '.') {
+		return false;
+	}
+	std::string_view rest = name.substr(prefix.size() + 1);
+	size_t dot = rest.find('.');
+	return dot != std::string_view::npos && isNumber(rest.substr(0, dot)) && isNumber(rest.substr(dot + 1));
+}
+
+LoggerShmCollector::LoggerShmCollector(const std::string& prefix, std::chrono::microseconds merge_window)
+	: prefix(prefix), merge_window(merge_window) { }
+
+LoggerShmCollector::~LoggerShmCollector() {
+	for (Segment& segment : segments) {
+		closeSegment(segment, false);
+	}
+}
+
+size_t LoggerShmCollector::collect(std::ostream& output, bool flush_all) {
+	openSegments();
+	for (Segment& segment : segments) {
+		// checked first, producer doesn't write after closing
+		bool finished = isFinished(segment);
+		readSegment(segment);
+		if (finished) {
+			// producer doesn't remove segments with unread records, or crashed
+			closeSegment(segment, true);
+		}
+	}
+	std::erase_if(segments, [](const Segment& segment) { return !segment.header; });
+	// entries of a segment are already in time order and stay in it
+	std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+		return a.time < b.time;
+	});
+	int64_t cutoff = std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch() - merge_window
+	).count();
+	size_t count = 0;
+	batch.clear();
+	while (count < entries.size() && (flush_all || entries[count].time <= cutoff)) {
+		batch.append(text, entries[count].offset, entries[count].size);
+		count++;
+	}
+	if (!batch.empty()) {
+		output.write(batch.data(), batch.size());
+		output.flush();
+	}
+	// held back entries move to the start of the text
+	std::string rest;
+	for (size_t i = count; i < entries.size(); i++) {
+		size_t offset = rest.size();
+		rest.append(text, entries[i].offset, entries[i].size);
+		entries[i].offset = offset;
+	}
+	entries.erase(entries.begin(), entries.begin() + count);
+	text.swap(rest);
+	return count;
+}
+
+size_t LoggerShmCollector::getSegmentCount() const {
+	return segments.size();
+}
+
+void LoggerShmCollector::openSegments() {
+#ifdef __linux__
+	std::error_code ec;
+	for (const std::filesystem::directory_entry& file : std::filesystem::directory_iterator("/dev/shm", ec)) {
+		std::string name = file.path().filename().string();
+		if (!isSegmentName(name, prefix)) {
+			continue;
+		}
+		name = "/" + name;
+		bool known = std::any_of(segments.begin(), segments.end(), [&](const Segment& segment) {
+			return segment.name == name;
+		});
+		if (known) {
+			continue;
+		}
+		int fd = shm_open(name.c_str(), O_RDWR, 0);
+		if (fd < 0) {
+			continue;
+		}
+		struct stat info;
+		void* address = MAP_FAILED;
+		if (fstat(fd, &info) == 0 && (size_t)info.st_size > LOGGER_SHM_DATA_OFFSET) {
+			address = mmap(nullptr, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		close(fd);
+		if (address == MAP_FAILED) {
+			continue;
+		}
+		LoggerShmHeader* header = (LoggerShmHeader*)address;
+		bool ready = memcmp(header->magic, LOGGER_SHM_MAGIC, sizeof(header->magic)) == 0;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (!ready || LOGGER_SHM_DATA_OFFSET + header->capacity != (size_t)info.st_size) {
+			// not initialized yet, next collect tries again
+			munmap(address, (size_t)info.st_size);
+			continue;
+		}
+		Segment segment;
+		segment.name = name;
+		segment.header = header;
+		segment.mapping_size = (size_t)info.st_size;
+		segments.push_back(segment);
+	}
+#endif
+}
+
+void LoggerShmCollector::readSegment(Segment& segment) {
+	LoggerShmHeader* header = segment.header;
+	const char* ring = (const char*)header + LOGGER_SHM_DATA_OFFSET;
+	uint64_t capacity = header->capacity;
+	uint64_t read_pos = header->read_pos.load(std::memory_order_relaxed);
+	uint64_t write_pos = header->write_pos.load(std::memory_order_acquire);
+	while (write_pos - read_pos >= LOGGER_SHM_ENTRY_HEADER) {
+		uint32_t size;
+		Entry entry;
+		loggerShmRead(ring, capacity, read_pos, &size, sizeof(size));
+		loggerShmRead(ring, capacity, read_pos + sizeof(size), &entry.time, sizeof(entry.time));
+		if (size > write_pos - read_pos - LOGGER_SHM_ENTRY_HEADER) {
+			// corrupted, skip everything written so far
+			read_pos = write_pos;
+			break;
+		}
+		entry.offset = text.size();
+		entry.size = size;
+		text.resize(text.size() + size);
+		loggerShmRead(ring, capacity, read_pos + LOGGER_SHM_ENTRY_HEADER, text.data() + entry.offset, size);
+		entries.push_back(entry);
+		read_pos += LOGGER_SHM_ENTRY_HEADER + size;
+	}
+	header->read_pos.store(read_pos, std::memory_order_release);
+	uint64_t dropped = header->dropped.load(std::memory_order_relaxed);
+	if (dropped > segment.dropped) {
+		Entry entry;
+		entry.time = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()
+		).count();
+		std::string note = "[" + segment.name + "] dropped " + std::to_string(dropped - segment.dropped) + " records\n";
+		entry.offset = text.size();
+		entry.size = note.size();
+		text += note;
+		entries.push_back(entry);
+		segment.dropped = dropped;
+	}
+}
+
+bool LoggerShmCollector::isFinished(const Segment& segment) const {
+	if (segment.header->closed.load(std::memory_order_acquire)) {
+		return true;
+	}
+#ifndef _WIN32
+	// producer crashed without closing the segment
+	return kill((pid_t)segment.header->pid, 0) != 0 && errno == ESRCH;
+#else
+	return false;
+#endif
+}
+
+void LoggerShmCollector::closeSegment(Segment& segment, bool unlink) {
+#ifndef _WIN32
+	if (!segment.header) {
+		return;
+	}
+	munmap(segment.header, segment.mapping_size);
+	segment.header = nullptr;
+	if (unlink) {
+		shm_unlink(segment.name.c_str());
+	}
+#endif
+}
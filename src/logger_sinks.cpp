@@ -0,0 +1,562 @@
+#include "logger_sinks.h"
+#include <cerrno>
+#include <cstring>
+#include <charconv>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static const int STDOUT_FD = 1;
+
+static int openAppend(const std::filesystem::path& path) {
+#ifdef _WIN32
+	return _wopen(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	return open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+#endif
+}
+
+static void closeFile(int fd) {
+#ifdef _WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+}
+
+// writes head and then all records, with a single writev if possible
+static void writeAll(int fd, std::string_view head, std::span<const std::string_view> records) {
+#ifdef _WIN32
+	if (!head.empty()) {
+		_write(fd, head.data(), (unsigned int)head.size());
+	}
+	// adjacent records are written with a single call
+	size_t first = 0;
+	while (first < records.size()) {
+		const char* data = records[first].data();
+		size_t size = records[first].size();
+		size_t next = first + 1;
+		while (next < records.size() && data + size == records[next].data()) {
+			size += records[next].size();
+			next++;
+		}
+		if (size > 0) {
+			_write(fd, data, (unsigned int)size);
+		}
+		first = next;
+	}
+#else
+	const size_t MAX_IOV = 1024;
+	iovec iov[MAX_IOV];
+	size_t next = 0;
+	bool head_pending = !head.empty();
+	while (head_pending || next < records.size()) {
+		size_t count = 0;
+		if (head_pending) {
+			iov[count++] = { (void*)head.data(), head.size() };
+			head_pending = false;
+		}
+		while (next < records.size()) {
+			std::string_view record = records[next];
+			if (count > 0 && (const char*)iov[count - 1].iov_base + iov[count - 1].iov_len == record.data()) {
+				// records are mostly adjacent in the logger's pages, a page takes a single entry
+				iov[count - 1].iov_len += record.size();
+			} else if (!record.empty()) {
+				if (count == MAX_IOV) {
+					break;
+				}
+				iov[count++] = { (void*)record.data(), record.size() };
+			}
+			next++;
+		}
+		size_t first = 0;
+		while (first < count) {
+			ssize_t written = writev(fd, iov + first, (int)(count - first));
+			if (written < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return;
+			}
+			// partial write, skip what was written
+			while (first < count && (size_t)written >= iov[first].iov_len) {
+				written -= iov[first].iov_len;
+				first++;
+			}
+			if (first < count) {
+				iov[first].iov_base = (char*)iov[first].iov_base + written;
+				iov[first].iov_len -= written;
+			}
+		}
+	}
+#endif
+}
+
+static size_t totalSize(std::span<const std::string_view> records) {
+	size_t size = 0;
+	for (std::string_view record : records) {
+		size += record.size();
+	}
+	return size;
+}
+
+LoggerStreamSink::LoggerStreamSink(std::ostream& stream) : stream(stream) { }
+
+void LoggerStreamSink::write(std::span<const std::string_view> records) {
+	for (std::string_view record : records) {
+		stream.write(record.data(), record.size());
+	}
+}
+
+void LoggerStreamSink::flush() {
+	stream.flush();
+}
+
+void LoggerStdoutSink::write(std::span<const std::string_view> records) {
+	// keeps order with whatever was written to std::cout before
+	std::cout.flush();
+	writeAll(STDOUT_FD, std::string_view(), records);
+}
+
+LoggerFileSink::LoggerFileSink(const std::filesystem::path& path, size_t buffer_size) : buffer_size(buffer_size) {
+	fd = openAppend(path);
+	buffer.reserve(buffer_size);
+}
+
+LoggerFileSink::~LoggerFileSink() {
+	flush();
+	if (fd >= 0) {
+		closeFile(fd);
+	}
+}
+
+bool LoggerFileSink::isOpen() const {
+	return fd >= 0;
+}
+
+void LoggerFileSink::write(std::span<const std::string_view> records) {
+	if (fd < 0) {
+		return;
+	}
+	if (buffer.size() + totalSize(records) <= buffer_size) {
+		for (std::string_view record : records) {
+			buffer += record;
+		}
+		return;
+	}
+	writeAll(fd, buffer, records);
+	buffer.clear();
+}
+
+void LoggerFileSink::flush() {
+	if (fd < 0 || buffer.empty()) {
+		return;
+	}
+	writeAll(fd, buffer, std::span<const std::string_view>());
+	buffer.clear();
+}
+
+LoggerRotatingFileSink::LoggerRotatingFileSink(
+	const std::filesystem::path& path,
+	size_t max_size,
+	std::chrono::seconds max_age,
+	size_t max_files
+) : path(path), max_size(max_size), max_age(max_age), max_files(max_files) {
+	open();
+}
+
+LoggerRotatingFileSink::~LoggerRotatingFileSink() {
+	if (fd >= 0) {
+		closeFile(fd);
+	}
+}
+
+bool LoggerRotatingFileSink::isOpen() const {
+	return fd >= 0;
+}
+
+void LoggerRotatingFileSink::write(std::span<const std::string_view> records) {
+	size_t size = totalSize(records);
+	bool too_large = file_size + size > max_size;
+	bool too_old = max_age.count() > 0 && std::chrono::steady_clock::now() - opened_at >= max_age;
+	if (file_size > 0 && (too_large || too_old)) {
+		rotate();
+	}
+	if (fd < 0) {
+		return;
+	}
+	writeAll(fd, std::string_view(), records);
+	file_size += size;
+}
+
+void LoggerRotatingFileSink::open() {
+	fd = openAppend(path);
+	std::error_code ec;
+	uintmax_t size = std::filesystem::file_size(path, ec);
+	file_size = ec ? 0 : (size_t)size;
+	opened_at = std::chrono::steady_clock::now();
+}
+
+void LoggerRotatingFileSink::rotate() {
+	if (fd >= 0) {
+		closeFile(fd);
+	}
+	std::error_code ec;
+	if (max_files == 0) {
+		std::filesystem::remove(path, ec);
+	} else {
+		std::filesystem::remove(rotatedPath(max_files), ec);
+		for (size_t i = max_files - 1; i >= 1; i--) {
+			std::filesystem::rename(rotatedPath(i), rotatedPath(i + 1), ec);
+		}
+		std::filesystem::rename(path, rotatedPath(1), ec);
+	}
+	open();
+}
+
+std::filesystem::path LoggerRotatingFileSink::rotatedPath(size_t index) const {
+	std::filesystem::path result = path;
+	result += "." + std::to_string(index);
+	return result;
+}
+
+LoggerMappedFileSink::LoggerMappedFileSink(const std::filesystem::path& path, size_t segment_size)
+	: path(path), segment_size(std::max((size_t)1, segment_size)) {
+	next_number = findNextNumber();
+	openSegment();
+}
+
+LoggerMappedFileSink::~LoggerMappedFileSink() {
+	closeSegment();
+}
+
+bool LoggerMappedFileSink::isOpen() const {
+	return fd >= 0;
+}
+
+void LoggerMappedFileSink::write(std::span<const std::string_view> records) {
+#ifdef _WIN32
+	if (fd >= 0) {
+		writeAll(fd, std::string_view(), records);
+	}
+#else
+	for (std::string_view record : records) {
+		while (!record.empty()) {
+			if (!mapping) {
+				return;
+			}
+			if (used == segment_size) {
+				closeSegment();
+				openSegment();
+				continue;
+			}
+			// records larger than the free space continue in the next segment
+			size_t size = std::min(record.size(), segment_size - used);
+			memcpy(mapping + used, record.data(), size);
+			used += size;
+			record.remove_prefix(size);
+		}
+	}
+#endif
+}
+
+size_t LoggerMappedFileSink::getSegmentCount() const {
+	return segment_numbers.size();
+}
+
+std::filesystem::path LoggerMappedFileSink::getSegmentPath(size_t index) const {
+	return numberedPath(segment_numbers[index]);
+}
+
+std::filesystem::path LoggerMappedFileSink::numberedPath(size_t number) const {
+	std::filesystem::path result = path;
+	result += "." + std::to_string(number);
+	return result;
+}
+
+size_t LoggerMappedFileSink::findNextNumber() const {
+	std::filesystem::path dir = path.parent_path();
+	if (dir.empty()) {
+		dir = ".";
+	}
+	std::string prefix = path.filename().string() + ".";
+	size_t next = 0;
+	std::error_code ec;
+	for (const std::filesystem::directory_entry& file : std::filesystem::directory_iterator(dir, ec)) {
+		std::string name = file.path().filename().string();
+		if (!name.starts_with(prefix)) {
+			continue;
+		}
+		const char* begin = name.data() + prefix.size();
+		const char* end = name.data() + name.size();
+		size_t number;
+		std::from_chars_result result = std::from_chars(begin, end, number);
+		if (begin == end || result.ec != std::errc() || result.ptr != end) {
+			continue;
+		}
+		next = std::max(next, number + 1);
+	}
+	return next;
+}
+
+void LoggerMappedFileSink::openSegment() {
+	used = 0;
+	// file is created here or not used at all, so segments of a crashed run stay intact
+	while (true) {
+		std::filesystem::path segment_path = numberedPath(next_number);
+		next_number++;
+#ifdef _WIN32
+		fd = _wopen(segment_path.c_str(), _O_WRONLY | _O_CREAT | _O_EXCL | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+		fd = open(segment_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+#endif
+		if (fd >= 0 || errno != EEXIST) {
+			break;
+		}
+	}
+	if (fd < 0) {
+		return;
+	}
+	segment_numbers.push_back(next_number - 1);
+#ifndef _WIN32
+	// blocks are reserved up front, so writing to the mapping can't fail with a full disk
+#ifdef __linux__
+	bool allocated = posix_fallocate(fd, 0, (off_t)segment_size) == 0;
+#else
+	bool allocated = ftruncate(fd, (off_t)segment_size) == 0;
+#endif
+	void* address = allocated
+		? mmap(nullptr, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+		: MAP_FAILED;
+	if (address == MAP_FAILED) {
+		close(fd);
+		fd = -1;
+		return;
+	}
+	mapping = (char*)address;
+#endif
+}
+
+void LoggerMappedFileSink::closeSegment() {
+	if (fd < 0) {
+		return;
+	}
+#ifndef _WIN32
+	munmap(mapping, segment_size);
+	mapping = nullptr;
+	// on failure the file keeps its preallocated size, unused part is zeros
+	int result = ftruncate(fd, (off_t)used);
+	(void)result;
+#endif
+	closeFile(fd);
+	fd = -1;
+}
+
+LoggerCompressedSink::LoggerCompressedSink(std::shared_ptr<LoggerSink> sink, size_t block_size) {
+	this->sink = sink;
+	this->block_size = std::max<size_t>(1, std::min(block_size, (size_t)LoggerBlockCodec::MAX_BLOCK_SIZE));
+	block.reserve(this->block_size);
+}
+
+LoggerCompressedSink::~LoggerCompressedSink() {
+	flush();
+}
+
+void LoggerCompressedSink::write(std::span<const std::string_view> records) {
+	for (std::string_view record : records) {
+		while (!record.empty()) {
+			// records larger than the free space continue in the next block
+			size_t size = std::min(record.size(), block_size - block.size());
+			block.append(record.data(), size);
+			record.remove_prefix(size);
+			if (block.size() == block_size) {
+				writeBlock();
+			}
+		}
+	}
+}
+
+void LoggerCompressedSink::flush() {
+	writeBlock();
+	sink->flush();
+}
+
+uint64_t LoggerCompressedSink::getRawSize() const {
+	return raw_size;
+}
+
+uint64_t LoggerCompressedSink::getCompressedSize() const {
+	return compressed_size;
+}
+
+void LoggerCompressedSink::writeBlock() {
+	if (block.empty()) {
+		return;
+	}
+	frame.clear();
+	if (!header_written) {
+		frame.append(LOGGER_COMPRESSED_MAGIC, sizeof(LOGGER_COMPRESSED_MAGIC) - 1);
+		header_written = true;
+	}
+	size_t header_pos = frame.size();
+	frame.append(1 + 2 * sizeof(uint32_t), '\0');
+	size_t payload_size = codec.compress(block, frame);
+	LoggerBlockType type = LoggerBlockType::Compressed;
+	if (payload_size >= block.size()) {
+		// doesn't compress, stored as is
+		frame.resize(header_pos + 1 + 2 * sizeof(uint32_t));
+		frame.append(block);
+		payload_size = block.size();
+		type = LoggerBlockType::Stored;
+	}
+	uint32_t sizes[2] = { (uint32_t)block.size(), (uint32_t)payload_size };
+	frame[header_pos] = (char)type;
+	memcpy(frame.data() + header_pos + 1, sizes, sizeof(sizes));
+	raw_size += block.size();
+	compressed_size += frame.size();
+	std::string_view record = frame;
+	sink->write(std::span<const std::string_view>(&record, 1));
+	block.clear();
+}
+
+static std::atomic<uint32_t> shm_sink_count = 0;
+
+LoggerShmSink::LoggerShmSink(const std::string& prefix, size_t capacity) {
+#ifndef _WIN32
+	capacity = std::max(capacity, (size_t)64);
+	mapping_size = LOGGER_SHM_DATA_OFFSET + capacity;
+	int fd;
+	do {
+		// every sink of a process gets its own segment,
+		// segment left by an earlier process with the same pid is skipped and not overwritten
+		name = "/" + prefix + "." + std::to_string(getpid()) + "." + std::to_string(shm_sink_count++);
+		fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	} while (fd < 0 && errno == EEXIST);
+	if (fd < 0) {
+		return;
+	}
+	void* address = ftruncate(fd, (off_t)mapping_size) == 0
+		? mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+		: MAP_FAILED;
+	close(fd);
+	if (address == MAP_FAILED) {
+		shm_unlink(name.c_str());
+		return;
+	}
+	header = new (address) LoggerShmHeader();
+	header->capacity = capacity;
+	header->pid = getpid();
+	// magic goes last, collector skips segments without it until they are ready
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(header->magic, LOGGER_SHM_MAGIC, sizeof(header->magic));
+#endif
+}
+
+LoggerShmSink::~LoggerShmSink() {
+#ifndef _WIN32
+	if (!header) {
+		return;
+	}
+	header->closed.store(1, std::memory_order_seq_cst);
+	bool drained = header->read_pos.load(std::memory_order_seq_cst) == header->write_pos.load(std::memory_order_relaxed);
+	munmap(header, mapping_size);
+	if (drained) {
+		shm_unlink(name.c_str());
+	}
+	// otherwise the collector removes the segment once it has read it
+#endif
+}
+
+bool LoggerShmSink::isOpen() const {
+	return header != nullptr;
+}
+
+void LoggerShmSink::write(std::span<const std::string_view> records) {
+	write(records, std::span<const LoggerRecordInfo>());
+}
+
+void LoggerShmSink::write(std::span<const std::string_view> records, std::span<const LoggerRecordInfo> infos) {
+	if (!header) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	int64_t write_time = 0;
+	if (infos.empty()) {
+		write_time = std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()
+		).count();
+	}
+	char* ring = (char*)header + LOGGER_SHM_DATA_OFFSET;
+	uint64_t capacity = header->capacity;
+	uint64_t write_pos = header->write_pos.load(std::memory_order_relaxed);
+	uint64_t read_pos = header->read_pos.load(std::memory_order_acquire);
+	for (size_t i = 0; i < records.size(); i++) {
+		std::string_view record = records[i];
+		// time never goes back within a segment, collector merges segments by it
+		last_time = std::max(last_time, infos.empty() ? write_time : infos[i].time);
+		size_t entry_size = LOGGER_SHM_ENTRY_HEADER + record.size();
+		if (entry_size > capacity - (write_pos - read_pos)) {
+			header->dropped.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		uint32_t size = (uint32_t)record.size();
+		loggerShmWrite(ring, capacity, write_pos, &size, sizeof(size));
+		loggerShmWrite(ring, capacity, write_pos + sizeof(size), &last_time, sizeof(last_time));
+		loggerShmWrite(ring, capacity, write_pos + LOGGER_SHM_ENTRY_HEADER, record.data(), record.size());
+		write_pos += entry_size;
+	}
+	// whole batch becomes visible at once
+	header->write_pos.store(write_pos, std::memory_order_release);
+}
+
+const std::string& LoggerShmSink::getName() const {
+	return name;
+}
+
+uint64_t LoggerShmSink::getDroppedCount() const {
+	return header ? header->dropped.load(std::memory_order_relaxed) : 0;
+}
+
+LoggerMemorySink::LoggerMemorySink(size_t capacity) {
+	records.resize(std::max((size_t)1, capacity));
+}
+
+void LoggerMemorySink::write(std::span<const std::string_view> batch) {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (std::string_view record : batch) {
+		if (size == records.size()) {
+			// overwrite the oldest record
+			head = (head + 1) % records.size();
+			size--;
+		}
+		records[(head + size) % records.size()].assign(record);
+		size++;
+	}
+}
+
+std::vector<std::string> LoggerMemorySink::getRecords() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<std::string> result;
+	for (size_t i = 0; i < size; i++) {
+		result.push_back(records[(head + i) % records.size()]);
+	}
+	return result;
+}
+
+std::string LoggerMemorySink::getText() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::string result;
+	for (size_t i = 0; i < size; i++) {
+		result += records[(head + i) % records.size()];
+	}
+	return result;
+}
@@ -1,6 +1,41 @@
 #include <iostream>
 #include <assert.h>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <thread>
+#include <new>
+#include <cstdlib>
+#include <csignal>
 #include "logger.h"
+#include "logger_decoder.h"
+#include "logger_sinks.h"
+#include "logger_compress.h"
+#include "logger_shm.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+std::atomic<size_t> allocation_count = 0;
+
+void* operator new(size_t size) {
+    allocation_count++;
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t size) noexcept {
+    std::free(ptr);
+}
 
 void basicTest() {
     Logger logger(true);
@@ -81,6 +116,30 @@ void onlineWriteTest() {
     assert(str == "Str2");
 }
 
+void onlineWriteThreadsTest() {
+    const int thread_count = 4;
+    const int line_count = 1000;
+    Logger logger(true);
+    logger.enableThreadSafe();
+    // callback isn't thread-safe itself
+    std::vector<std::string> lines;
+    logger.OnLineWrite = [&](std::string line) {
+        lines.push_back(line);
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.push_back(std::thread([&]() {
+            for (int i = 0; i < line_count; i++) {
+                logger << "Line\n";
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    assert(lines.size() == thread_count * line_count);
+}
+
 void tagTest() {
     Logger logger(true);
     LoggerTag tag1(logger, "tag1");
@@ -260,6 +319,1635 @@ void nestedTags2Test() {
     );
 }
 
+void asyncWriteTest() {
+    std::ostringstream stream;
+    Logger logger(true);
+    logger.addSink(std::make_shared<LoggerStreamSink>(stream));
+    logger.enableAsync();
+    logger.setAutoFlush(false);
+    logger << "Line1\n";
+    logger << "Line2\n";
+    assert(logger.isAsync());
+    logger.flush();
+    assert(stream.str() == "Line1\nLine2\n");
+}
+
+// holds writes until it's opened, remembers where records came from
+class GatedSink : public LoggerSink {
+public:
+    void write(std::span<const std::string_view> batch) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        opened.wait(lock, [this]() { return is_open; });
+        for (std::string_view record : batch) {
+            records.push_back(std::string(record));
+            addresses.push_back(record.data());
+        }
+    }
+    void open() {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_open = true;
+        opened.notify_all();
+    }
+    std::vector<std::string> getRecords() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return records;
+    }
+    std::vector<const char*> getAddresses() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return addresses;
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable opened;
+    bool is_open = false;
+    std::vector<std::string> records;
+    std::vector<const char*> addresses;
+};
+
+std::vector<std::string> asyncWrittenLines(LoggerOverflowPolicy policy, size_t& dropped) {
+    const size_t line_count = 1000;
+    auto sink = std::make_shared<GatedSink>();
+    std::vector<std::string> records;
+    {
+        Logger logger(true);
+        logger.addSink(sink);
+        LoggerAsyncOptions options;
+        options.capacity = 4;
+        options.overflow_policy = policy;
+        logger.enableAsync(options);
+        // writer thread is stuck in the sink, so the queue fills up
+        for (size_t i = 0; i < line_count; i++) {
+            logger << "Line " << i << "\n";
+        }
+        sink->open();
+        logger.flush();
+        dropped = logger.getDroppedCount();
+        records = sink->getRecords();
+    }
+    assert(records.size() + dropped == line_count);
+    return records;
+}
+
+void asyncBlockTest() {
+    std::ostringstream stream;
+    {
+        Logger logger;
+        logger.addSink(std::make_shared<LoggerStreamSink>(stream));
+        LoggerAsyncOptions options;
+        options.capacity = 4;
+        logger.enableAsync(options);
+        for (size_t i = 0; i < 1000; i++) {
+            logger << "Line " << i << "\n";
+        }
+        logger.flush();
+        assert(logger.getDroppedCount() == 0);
+    }
+    std::string str = stream.str();
+    assert(std::count(str.begin(), str.end(), '\n') == 1000);
+}
+
+void asyncDropNewestTest() {
+    size_t dropped;
+    std::vector<std::string> records = asyncWrittenLines(LoggerOverflowPolicy::DropNewest, dropped);
+    assert(dropped > 0);
+    assert(records.front() == "Line 0\n");
+}
+
+void asyncDropOldestTest() {
+    size_t dropped;
+    std::vector<std::string> records = asyncWrittenLines(LoggerOverflowPolicy::DropOldest, dropped);
+    assert(dropped > 0);
+    assert(records.back() == "Line 999\n");
+}
+
+std::vector<std::string> splitLines(const std::string& str) {
+    std::vector<std::string> lines;
+    std::stringstream ss(str);
+    std::string line;
+    while (std::getline(ss, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+void threadSafeOrderTest() {
+    const int thread_count = 8;
+    const int line_count = 1000;
+    Logger logger(true);
+    logger.enableThreadSafe(64);
+    logger.setAutoFlush(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.push_back(std::thread([&, t]() {
+            for (int i = 0; i < line_count; i++) {
+                logger << t << " " << i << "\n";
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    logger.flush();
+    std::vector<std::string> lines = splitLines(logger.getTotalBuffer());
+    assert(lines.size() == thread_count * line_count);
+    std::vector<int> next(thread_count, 0);
+    for (const std::string& line : lines) {
+        int t, i;
+        std::stringstream ss(line);
+        ss >> t >> i;
+        assert(i == next[t]);
+        next[t]++;
+    }
+}
+
+void threadSafeScopesTest() {
+    Logger logger(true);
+    logger.enableThreadSafe();
+    logger.setAutoFlush(false);
+    LoggerDisableTag disable_tag2(logger, "tag2");
+    std::thread thread1([&]() {
+        LoggerTag tag1(logger, "tag1");
+        LoggerIndent indent(logger);
+        logger << "thread1\n";
+    });
+    thread1.join();
+    std::thread thread2([&]() {
+        LoggerTag tag2(logger, "tag2");
+        logger << "thread2\n";
+    });
+    thread2.join();
+    logger << "main\n";
+    logger.flush();
+    assert(logger.getTotalBuffer() == "|   thread1\nmain\n");
+}
+
+void sinkChangeThreadsTest() {
+    const int thread_count = 4;
+    const int line_count = 2000;
+    Logger logger;
+    auto memory_sink = std::make_shared<LoggerMemorySink>(thread_count * line_count);
+    logger.addSink(memory_sink);
+    logger.enableThreadSafe();
+    std::atomic<bool> writing = true;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.push_back(std::thread([&]() {
+            for (int i = 0; i < line_count; i++) {
+                logger << "Line\n";
+            }
+        }));
+    }
+    std::thread changer([&]() {
+        while (writing) {
+            auto extra_sink = std::make_shared<LoggerMemorySink>(16);
+            logger.addSink(extra_sink);
+            logger.removeSink(extra_sink);
+            auto staged_sink = std::make_shared<LoggerMemorySink>(16);
+            logger.addSink(staged_sink, LoggerAsyncOptions());
+            logger.removeSink(staged_sink);
+        }
+    });
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    writing = false;
+    changer.join();
+    logger.flush();
+    assert(memory_sink->getRecords().size() == thread_count * line_count);
+}
+
+void zeroAllocationTest() {
+    Logger logger;
+    Logger::disableStdWrite();
+    std::string str = "std::string";
+    auto write_line = [&](int i) {
+        logger << "Line " << i << " " << str << " " << true << " " << std::string_view("view") << " " << i / 3.0 << "\n";
+    };
+    // buffers grow to the longest line during warm-up
+    for (int i = 0; i < 1000; i++) {
+        write_line(i);
+    }
+    size_t allocations_before = allocation_count;
+    for (int i = 0; i < 1000; i++) {
+        write_line(i);
+    }
+    size_t allocations = allocation_count - allocations_before;
+    Logger::enableStdWrite();
+    assert(allocations == 0);
+}
+
+bool matchesPattern(const std::string& str, const std::string& pattern) {
+    // '#' in pattern matches any digit
+    if (str.size() != pattern.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < str.size(); i++) {
+        if (pattern[i] == '#' ? !isdigit(str[i]) : str[i] != pattern[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void threadBatchOrderTest() {
+    const int thread_count = 8;
+    const int line_count = 1003;
+    Logger logger(true);
+    LoggerThreadSafeOptions options;
+    options.ring_capacity = 16;
+    options.batch_lines = 16;
+    options.thread_prefix = true;
+    logger.enableThreadSafe(options);
+    logger.setAutoFlush(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.push_back(std::thread([&, t]() {
+            for (int i = 0; i < line_count; i++) {
+                logger << t << " " << i << "\n";
+            }
+            // rest of the batch is published when the thread exits
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    logger.flush();
+    std::vector<std::string> lines = splitLines(logger.getTotalBuffer());
+    assert(lines.size() == thread_count * line_count);
+    std::vector<int> next(thread_count, 0);
+    std::vector<std::string> prefixes(thread_count);
+    for (const std::string& line : lines) {
+        int t, i;
+        std::string prefix;
+        std::stringstream ss(line);
+        ss >> prefix >> t >> i;
+        assert(matchesPattern(prefix, "[T#]"));
+        assert(prefixes[t].empty() || prefixes[t] == prefix);
+        prefixes[t] = prefix;
+        assert(i == next[t]);
+        next[t]++;
+    }
+}
+
+void threadBatchIdleTest() {
+    Logger logger(true);
+    LoggerThreadSafeOptions options;
+    options.batch_lines = 64;
+    options.batch_interval = std::chrono::milliseconds(1);
+    logger.enableThreadSafe(options);
+    std::mutex mutex;
+    std::condition_variable done_cv;
+    bool written = false;
+    bool done = false;
+    std::thread worker([&]() {
+        logger << "Worker\n";
+        // stays alive without writing, so it never publishes the batch itself
+        std::unique_lock<std::mutex> lock(mutex);
+        written = true;
+        done_cv.notify_all();
+        done_cv.wait(lock, [&]() { return done; });
+    });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&]() { return written; });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    // writing thread publishes the old batch
+    logger << "Main1\n";
+    assert(logger.getTotalBuffer() == "Worker\n");
+    logger << "Main2\n";
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    done_cv.notify_all();
+    worker.join();
+    logger.flush();
+    assert(logger.getTotalBuffer() == "Worker\nMain1\nMain2\n");
+    // flush publishes it too
+    std::thread worker2([&]() {
+        logger << "Worker2\n";
+        std::unique_lock<std::mutex> lock(mutex);
+        done = false;
+        done_cv.notify_all();
+        done_cv.wait(lock, [&]() { return done; });
+    });
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [&]() { return !done; });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    logger.flush();
+    assert(logger.getTotalBuffer() == "Worker\nMain1\nMain2\nWorker2\n");
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+    }
+    done_cv.notify_all();
+    worker2.join();
+}
+
+void threadBatchMergeTest() {
+    const int thread_count = 4;
+    const int line_count = 500;
+    Logger logger;
+    auto memory_sink = std::make_shared<LoggerMemorySink>(thread_count * line_count);
+    logger.addSink(memory_sink);
+    logger.setClock(LoggerClock::Monotonic);
+    logger.setTimePrecision(LoggerTimePrecision::Microseconds);
+    LoggerThreadSafeOptions options;
+    options.batch_lines = 8;
+    logger.enableThreadSafe(options);
+    logger.setAutoFlush(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.push_back(std::thread([&]() {
+            for (int i = 0; i < line_count; i++) {
+                logger << "Line\n";
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    logger.flush();
+    // everything is drained at once, so the whole output is ordered by time
+    std::vector<std::string> records = memory_sink->getRecords();
+    assert(records.size() == thread_count * line_count);
+    for (size_t i = 1; i < records.size(); i++) {
+        assert(records[i - 1] <= records[i]);
+    }
+}
+
+void timePrecisionTest() {
+    Logger logger;
+    logger << "Str";
+    assert(matchesPattern(logger.getLineBuffer(), "[##:##:##] Str"));
+    logger << LoggerFlush();
+    logger.setTimePrecision(LoggerTimePrecision::Milliseconds);
+    logger << "\nStr";
+    assert(matchesPattern(logger.getLineBuffer(), "[##:##:##.###] Str"));
+    logger << LoggerFlush();
+    logger.setTimePrecision(LoggerTimePrecision::Microseconds);
+    logger << "\nStr";
+    assert(matchesPattern(logger.getLineBuffer(), "[##:##:##.######] Str"));
+    logger << LoggerFlush() << "\n";
+}
+
+void monotonicClockTest() {
+    Logger logger;
+    logger.setClock(LoggerClock::Monotonic);
+    logger << "Str";
+    assert(logger.getLineBuffer() == "[00:00:00] Str");
+    logger << LoggerFlush() << "\n";
+}
+
+void timestampThreadsTest() {
+    LoggerTimestamp timestamp;
+    timestamp.setPrecision(LoggerTimePrecision::Microseconds);
+    std::vector<std::thread> threads;
+    std::atomic<bool> failed = false;
+    for (int t = 0; t < 4; t++) {
+        threads.push_back(std::thread([&]() {
+            std::string buffer;
+            for (int i = 0; i < 10000; i++) {
+                buffer.clear();
+                timestamp.write(buffer, timestamp.now());
+                if (!matchesPattern(buffer, "[##:##:##.######] ")) {
+                    failed = true;
+                }
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    assert(!failed);
+}
+
+std::string countedString(int& counter) {
+    counter++;
+    return "counted";
+}
+
+void levelTest() {
+    Logger logger(true);
+    int evaluated = 0;
+    logger.setLevel(LoggerLevel::Info);
+    LOGGER_DEBUG(logger) << countedString(evaluated) << " debug\n";
+    LOGGER_INFO(logger) << countedString(evaluated) << " info\n";
+    LOGGER_ERROR(logger) << countedString(evaluated) << " error\n";
+    // statements below LOGGER_MIN_LEVEL are compiled out
+    std::string expected;
+    if (LOGGER_MIN_LEVEL <= LOGGER_LEVEL_INFO) {
+        expected += "counted info\n";
+    }
+    if (LOGGER_MIN_LEVEL <= LOGGER_LEVEL_ERROR) {
+        expected += "counted error\n";
+    }
+    assert(evaluated == (int)splitLines(expected).size());
+    assert(logger.getTotalBuffer() == expected);
+    logger.setLevel(LoggerLevel::Off);
+    LOGGER_ERROR(logger) << countedString(evaluated) << " error\n";
+    assert(evaluated == (int)splitLines(expected).size());
+}
+
+// statements below the compile-time level are discarded even if the runtime level allows them
+#pragma push_macro("LOGGER_MIN_LEVEL")
+#undef LOGGER_MIN_LEVEL
+#define LOGGER_MIN_LEVEL LOGGER_LEVEL_WARN
+void compileTimeLevelTest() {
+    Logger logger(true);
+    int evaluated = 0;
+    LOGGER_INFO(logger) << countedString(evaluated) << " info\n";
+    LOGGER_WARN(logger) << countedString(evaluated) << " warn\n";
+    assert(evaluated == 1);
+    assert(logger.getTotalBuffer() == "counted warn\n");
+}
+#pragma pop_macro("LOGGER_MIN_LEVEL")
+
+void tagHandleTest() {
+    LoggerTagHandle tag1 = LoggerTagRegistry::registerTag("tag1");
+    LoggerTagHandle tag2 = LoggerTagRegistry::registerTag("tag2");
+    assert(LoggerTagRegistry::registerTag("tag1").id == tag1.id);
+    assert(LoggerTagRegistry::getName(tag2) == "tag2");
+    Logger logger(true);
+    LoggerDisableTag disable_tag2(logger, tag2);
+    assert(logger.isTagDisabled(tag2));
+    {
+        LoggerTag tag(logger, tag1);
+        logger << "tag1\n";
+    }
+    {
+        // string and handle refer to the same tag
+        LoggerTag tag(logger, "tag2");
+        logger << "tag2\n";
+    }
+    assert(logger.getTotalBuffer() == "tag1\n");
+}
+
+void tagScopeAllocationTest() {
+    LoggerTagHandle tag1 = LoggerTagRegistry::registerTag("tag1");
+    Logger logger(true);
+    {
+        LoggerTag tag(logger, tag1);
+    }
+    size_t allocations_before = allocation_count;
+    for (int i = 0; i < 1000; i++) {
+        LoggerTag tag(logger, tag1);
+        LoggerDisableTag disable_tag(logger, tag1);
+    }
+    assert(allocation_count == allocations_before);
+}
+
+void writeBinaryTestLines(Logger& logger) {
+    std::string str = "string";
+    logger << "Line1\n";
+    {
+        LoggerIndent indent(logger);
+        LOGGER_RECORD(logger, "int={} uint={} size={} ptrdiff={}", -1, 2u, (size_t)3, (ptrdiff_t)-4);
+        LOGGER_RECORD(logger, "float={} double={} bool={}", 1.5f, 2.5, true);
+        LOGGER_RECORD(logger, "str={} view={} literal={}", str, std::string_view("view"), "literal");
+        LOGGER_RECORD(logger, "");
+        logger << "Partial";
+        LOGGER_RECORD(logger, " record {}", 1);
+        logger << "Flushed" << LoggerFlush() << " continued\n\n";
+    }
+    LOGGER_RECORD(logger, "no args");
+}
+
+std::string decodeFile(const std::filesystem::path& path) {
+    std::ifstream input(path, std::ios::binary);
+    std::ostringstream output;
+    LoggerBinaryDecoder decoder;
+    bool ok = decoder.decode(input, output);
+    assert(ok);
+    return output.str();
+}
+
+void binaryRoundTripTest() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_binary_test.bin";
+    Logger text_logger(true);
+    writeBinaryTestLines(text_logger);
+    {
+        Logger binary_logger(true);
+        binary_logger.setAutoFlush(false);
+        bool ok = binary_logger.enableBinary(path);
+        assert(ok);
+        writeBinaryTestLines(binary_logger);
+        binary_logger.disableBinary();
+    }
+    assert(decodeFile(path) == text_logger.getTotalBuffer());
+    std::filesystem::remove(path);
+}
+
+void binaryTimeTest() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_binary_time_test.bin";
+    {
+        Logger binary_logger;
+        binary_logger.setClock(LoggerClock::Monotonic);
+        binary_logger.enableBinary(path);
+        LoggerIndent indent(binary_logger);
+        LOGGER_RECORD(binary_logger, "x={}", 1);
+    }
+    assert(decodeFile(path) == "[00:00:00] |   x=1\n");
+    std::filesystem::remove(path);
+}
+
+void numberFormatTest() {
+    Logger logger(true);
+    logger << 0.1 << " " << 1.5f << " " << 1e300 << " " << -42 << " " << (size_t)255 << "\n";
+    assert(logger.getTotalBuffer() == "0.1 1.5 1e+300 -42 255\n");
+    LoggerNumberFormat format;
+    format.float_format = LoggerFloatFormat::Fixed;
+    format.precision = 2;
+    format.hex = true;
+    logger.setNumberFormat(format);
+    logger << 3.14159 << " " << 255 << " " << (ptrdiff_t)-255 << "\n";
+    format.float_format = LoggerFloatFormat::Scientific;
+    logger.setNumberFormat(format);
+    LOGGER_RECORD(logger, "{} {}", 1234.5, 16u);
+    assert(splitLines(logger.getTotalBuffer())[1] == "3.14 ff -ff");
+    assert(splitLines(logger.getTotalBuffer())[2] == "1.23e+03 10");
+    // largest values fit into the stack buffer
+    format.float_format = LoggerFloatFormat::Fixed;
+    format.precision = LoggerFormat::MAX_PRECISION;
+    char buffer[LoggerFormat::MAX_NUMBER_LENGTH];
+    assert(LoggerFormat::format(buffer, -1.7976931348623157e308, format).size() == 1 + 309 + 1 + 64);
+    logger.setNumberFormat(LoggerNumberFormat());
+    logger << 1.0 / 3.0 << " " << 123456789;
+    assert(logger.getLineBuffer() == "0.3333333333333333 123456789");
+    logger << "\n";
+}
+
+void binaryNumberFormatTest() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_binary_number_test.bin";
+    {
+        Logger binary_logger(true);
+        LoggerNumberFormat format;
+        format.float_format = LoggerFloatFormat::Fixed;
+        format.precision = 1;
+        format.hex = true;
+        binary_logger.setNumberFormat(format);
+        binary_logger.enableBinary(path);
+        LOGGER_RECORD(binary_logger, "{} {}", 2.25, 26);
+    }
+    assert(decodeFile(path) == "2.2 1a\n");
+    std::filesystem::remove(path);
+}
+
+struct TestPoint {
+    int x;
+    int y;
+};
+
+template<>
+struct LoggerFormatter<TestPoint> {
+    static void format(std::string& out, const TestPoint& value) {
+        out += "(";
+        LoggerFormat::append(out, value.x);
+        out += ", ";
+        LoggerFormat::append(out, value.y);
+        out += ")";
+    }
+};
+
+void logTest() {
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_INFO
+    Logger logger(true);
+    std::string str = "str";
+    logger.log(LoggerLevel::Info, "x={} y={} {} {} {}", 1, 2.5, str, std::string_view("view"), true);
+    logger.log(LoggerLevel::Info, "no args");
+    logger.log(LoggerLevel::Info, "{}{}", "multi\n", "line");
+    {
+        LoggerIndent indent(logger);
+        logger.log(LoggerLevel::Info, "point={}", TestPoint { 3, -4 });
+        logger << "point=" << TestPoint { 5, 6 } << "\n";
+    }
+    logger.setLevel(LoggerLevel::Warn);
+    logger.log(LoggerLevel::Info, "filtered {}", 1);
+    logger.log(LoggerLevel::Error, "error {}", 2);
+    {
+        LoggerDisableTag disable_tag(logger, "tag");
+        LoggerTag tag(logger, "tag");
+        logger.log(LoggerLevel::Error, "disabled {}", 3);
+    }
+    std::vector<std::string> lines = splitLines(logger.getTotalBuffer());
+    assert(lines.size() == 7);
+    assert(lines[0] == "x=1 y=2.5 str view true");
+    assert(lines[1] == "no args");
+    assert(lines[2] == "multi");
+    assert(lines[3] == "line");
+    assert(lines[4] == "|   point=(3, -4)");
+    assert(lines[5] == "|   point=(5, 6)");
+    assert(lines[6] == "error 2");
+    // arguments go straight into the line buffer, after the prefix and any partial line
+    Logger indent_logger(true);
+    {
+        LoggerIndent indent(indent_logger);
+        indent_logger << "start ";
+        indent_logger.log(LoggerLevel::Info, "x={}", 1);
+        indent_logger.log(LoggerLevel::Info, "");
+        indent_logger.log(LoggerLevel::Info, "{}{}", "\nsecond\n", "third");
+    }
+    assert(indent_logger.getTotalBuffer() == "|   start x=1\n\n\n|   second\n|   third\n");
+#endif
+}
+
+void logAllocationTest() {
+    Logger logger;
+    Logger::disableStdWrite();
+    for (int i = 0; i < 1000; i++) {
+        logger.log(LoggerLevel::Info, "i={} half={} point={}", i, i * 0.5, TestPoint { i, -i });
+    }
+    size_t allocations_before = allocation_count;
+    for (int i = 0; i < 1000; i++) {
+        logger.log(LoggerLevel::Info, "i={} half={} point={}", i, i * 0.5, TestPoint { i, -i });
+    }
+    size_t allocations = allocation_count - allocations_before;
+    Logger::enableStdWrite();
+    assert(allocations == 0);
+}
+
+void writeLiteralTestLines(Logger& logger) {
+    logger << "Line1\n"_log;
+    {
+        LoggerIndent indent(logger);
+        logger << "Line"_log << 2 << "\n"_log;
+        logger << "Start "_log << "end\n"_log;
+        logger << "Multi\nline\n"_log;
+        logger << "Braces {}\n"_log;
+    }
+    logger << "\n"_log;
+    logger << ""_log << "Last\n"_log;
+}
+
+void literalTest() {
+    Logger logger(true);
+    writeLiteralTestLines(logger);
+    assert(logger.getTotalBuffer() == "Line1\n|   Line2\n|   Start end\n|   Multi\n|   line\n|   Braces {}\n\nLast\n");
+    static_assert(LoggerLiteral<"Line\n">::is_record);
+    static_assert(!LoggerLiteral<"Line">::is_line);
+    static_assert(!LoggerLiteral<"A\nB\n">::is_line);
+    static_assert(!LoggerLiteral<"{}\n">::is_record);
+    assert(LoggerLiteral<"Line\n">::id() == LoggerLiteral<"Line\n">::id());
+    assert(LoggerLiteral<"Line\n">::id() != LoggerLiteral<"Line2\n">::id());
+}
+
+void binaryLiteralTest() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_binary_literal_test.bin";
+    Logger text_logger(true);
+    writeLiteralTestLines(text_logger);
+    {
+        Logger binary_logger(true);
+        bool ok = binary_logger.enableBinary(path);
+        assert(ok);
+        writeLiteralTestLines(binary_logger);
+        binary_logger.disableBinary();
+    }
+    assert(decodeFile(path) == text_logger.getTotalBuffer());
+    std::filesystem::remove(path);
+}
+
+void literalAllocationTest() {
+    Logger logger;
+    Logger::disableStdWrite();
+    for (int i = 0; i < 1000; i++) {
+        logger << "Constant line\n"_log;
+    }
+    size_t allocations_before = allocation_count;
+    for (int i = 0; i < 1000; i++) {
+        logger << "Constant line\n"_log;
+    }
+    size_t allocations = allocation_count - allocations_before;
+    Logger::enableStdWrite();
+    assert(allocations == 0);
+}
+
+void indentStyleTest() {
+    Logger logger(true);
+    LoggerIndentStyle style;
+    style.glyph = ">";
+    style.width = 2;
+    style.max_depth = 2;
+    logger.setIndentStyle(style);
+    {
+        LoggerIndent indent1(logger);
+        logger << "Line1\n";
+        LoggerIndent indent2(logger, 3);
+        logger << "Line2\n";
+    }
+    logger.setIndentStyle(LoggerIndentStyle());
+    {
+        // deeper than the prebuilt table
+        LoggerIndent indent(logger, LoggerIndentTable::TABLE_DEPTH + 2);
+        logger << "Line3\n";
+    }
+    std::vector<std::string> lines = splitLines(logger.getTotalBuffer());
+    assert(lines[0] == "> Line1");
+    assert(lines[1] == "> > Line2");
+    std::string deep;
+    for (size_t i = 0; i < LoggerIndentTable::TABLE_DEPTH + 2; i++) {
+        deep += "|   ";
+    }
+    assert(lines[2] == deep + "Line3");
+}
+
+void binaryIndentStyleTest() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_binary_indent_test.bin";
+    {
+        Logger binary_logger(true);
+        LoggerIndentStyle style;
+        style.glyph = "..";
+        style.width = 0;
+        style.max_depth = 1;
+        binary_logger.setIndentStyle(style);
+        binary_logger.enableBinary(path);
+        LoggerIndent indent(binary_logger, 2);
+        binary_logger << "Line\n";
+    }
+    assert(decodeFile(path) == "..Line\n");
+    std::filesystem::remove(path);
+}
+
+void rateLimitTest() {
+    Logger logger(true);
+    logger.setSuppressedSummaryInterval(std::chrono::milliseconds(0));
+    int evaluated = 0;
+    auto counted = [&](int i) {
+        evaluated++;
+        return i;
+    };
+    const int every_line = __LINE__ + 2;
+    for (int i = 0; i < 10; i++) {
+        LOGGER_EVERY_N(logger, 4) << "every " << counted(i) << "\n";
+    }
+    const int first_line = __LINE__ + 2;
+    for (int i = 0; i < 10; i++) {
+        LOGGER_FIRST_N(logger, 2) << "first " << counted(i) << "\n";
+    }
+    for (int i = 0; i < 10; i++) {
+        LOGGER_PER_SECOND(logger, 3) << "second " << counted(i) << "\n";
+    }
+    // arguments of suppressed statements are not evaluated
+    assert(evaluated == 3 + 2 + 3 || evaluated == 3 + 2 + 6);
+    std::vector<std::string> lines = splitLines(logger.getTotalBuffer());
+    assert(lines[0] == "every 0");
+    assert(lines[1] == "every 4");
+    assert(lines[2] == "every 8");
+    assert(lines[3] == "first 0");
+    assert(lines[4] == "first 1");
+    assert(lines[5] == "second 0");
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_WARN
+    logger.writeSuppressedSummary();
+    lines = splitLines(logger.getTotalBuffer());
+    assert(std::find(lines.begin(), lines.end(), "Suppressed 7 lines at main.cpp:" + std::to_string(every_line)) != lines.end());
+    assert(std::find(lines.begin(), lines.end(), "Suppressed 8 lines at main.cpp:" + std::to_string(first_line)) != lines.end());
+    // counts are reset after the summary
+    size_t size = logger.getTotalBuffer().size();
+    logger.writeSuppressedSummary();
+    assert(logger.getTotalBuffer().size() == size);
+    // and kept while the summary is filtered out
+    const int kept_line = __LINE__ + 2;
+    for (int i = 0; i < 3; i++) {
+        LOGGER_FIRST_N(logger, 1) << "kept " << i << "\n";
+    }
+    logger.setLevel(LoggerLevel::Error);
+    logger.writeSuppressedSummary();
+    assert(splitLines(logger.getTotalBuffer()).back() == "kept 0");
+    logger.setLevel(LoggerLevel::Trace);
+    logger.writeSuppressedSummary();
+    assert(splitLines(logger.getTotalBuffer()).back() == "Suppressed 2 lines at main.cpp:" + std::to_string(kept_line));
+#endif
+}
+
+void rateLimitSummaryTest() {
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_WARN
+    Logger logger(true);
+    logger.setSuppressedSummaryInterval(std::chrono::milliseconds(10));
+    auto write = [&]() {
+        LOGGER_FIRST_N(logger, 1) << "first\n";
+        LOGGER_EVERY_N(logger, 2) << "every\n";
+    };
+    for (int i = 0; i < 4; i++) {
+        write();
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    // summary is written when the next statement passes after the interval
+    write();
+    std::vector<std::string> lines = splitLines(logger.getTotalBuffer());
+    assert(lines.size() == 6);
+    assert(lines[0] == "first");
+    assert(lines[1] == "every");
+    assert(lines[2] == "every");
+    std::sort(lines.begin() + 3, lines.begin() + 5);
+    assert(lines[3].starts_with("Suppressed 2 lines at main.cpp:"));
+    assert(lines[4].starts_with("Suppressed 4 lines at main.cpp:"));
+    assert(lines[5] == "every");
+    // statements that are only suppressed write it too
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const int suppressed_line = __LINE__ + 2;
+    for (int i = 0; i < 1500; i++) {
+        LOGGER_FIRST_N(logger, 0) << "never\n";
+    }
+    lines = splitLines(logger.getTotalBuffer());
+    assert(lines.size() == 7);
+    assert(lines[6] == "Suppressed 1024 lines at main.cpp:" + std::to_string(suppressed_line));
+#endif
+}
+
+void rateLimitLoggersTest() {
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_WARN
+    Logger logger1(true);
+    Logger logger2(true);
+    logger1.setSuppressedSummaryInterval(std::chrono::milliseconds(0));
+    logger2.setSuppressedSummaryInterval(std::chrono::milliseconds(0));
+    for (int i = 0; i < 3; i++) {
+        LOGGER_FIRST_N(logger1, 1) << "first\n";
+    }
+    // counts of other loggers' call sites are left alone
+    logger2.writeSuppressedSummary();
+    assert(logger2.getTotalBuffer() == "");
+    logger1.writeSuppressedSummary();
+    std::vector<std::string> lines = splitLines(logger1.getTotalBuffer());
+    assert(lines.size() == 2);
+    assert(lines[1].starts_with("Suppressed 2 lines at main.cpp:"));
+#endif
+}
+
+void lazyWriteTest() {
+    Logger logger(true);
+    int calls = 0;
+    auto dump = [&]() {
+        calls++;
+        return std::string("dump");
+    };
+    auto dump_to = [&](Logger& l) {
+        calls++;
+        l << "dump " << 1;
+    };
+    logger << dump << " " << dump_to << "\n";
+    {
+        LoggerDisableTag disable_tag(logger, "verbose");
+        LoggerTag tag(logger, "verbose");
+        assert(!logger.enabled());
+        logger << dump << dump_to << "\n";
+    }
+    assert(logger.enabled());
+    assert(calls == 2);
+    assert(logger.getTotalBuffer() == "dump dump 1\n");
+}
+
+void enabledTagTest() {
+    Logger logger(true);
+    LoggerTagHandle tag1 = LoggerTagRegistry::registerTag("enabled_tag1");
+    LoggerTagHandle tag2 = LoggerTagRegistry::registerTag("enabled_tag2");
+    assert(logger.enabled(tag1));
+    {
+        LoggerDisableTag disable_tag(logger, tag1);
+        assert(!logger.enabled(tag1));
+        assert(logger.enabled("enabled_tag2"));
+        // current scope doesn't matter
+        LoggerTag tag(logger, tag1);
+        assert(logger.enabled(tag2));
+    }
+    assert(logger.enabled(tag1));
+    {
+        LoggerDeactivate deactivate(logger);
+        LoggerEnableTag enable_tag(logger, tag2);
+        assert(!logger.enabled(tag1));
+        assert(logger.enabled(tag2));
+    }
+    logger.manualDeactivate();
+    assert(!logger.enabled(tag1));
+    logger.manualActivate();
+    // queries don't register tags
+    LoggerTagHandle unknown;
+    assert(logger.enabled("enabled_unknown_tag"));
+    assert(!LoggerTagRegistry::findTag("enabled_unknown_tag", unknown));
+}
+
+void tagOverflowTest() {
+#ifndef _WIN32
+    // registry is shared by the whole process, so it's filled up in a child
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        for (size_t i = 0; i < LoggerTagRegistry::MAX_TAGS; i++) {
+            LoggerTagRegistry::registerTag("overflow_tag" + std::to_string(i));
+        }
+        LoggerTagHandle extra1 = LoggerTagRegistry::registerTag("overflow_extra1");
+        LoggerTagHandle extra2 = LoggerTagRegistry::registerTag("overflow_extra2");
+        assert(extra1.id == LoggerTagRegistry::OVERFLOW_TAG);
+        assert(extra2.id == LoggerTagRegistry::OVERFLOW_TAG);
+        assert(LoggerTagRegistry::getName(extra1) == "<overflow>");
+        Logger logger(true);
+        // extra tags share one set of flags
+        LoggerDisableTag disable_tag(logger, extra1);
+        assert(!logger.enabled(extra2));
+        assert(!logger.enabled("overflow_extra2"));
+        {
+            LoggerTag tag(logger, "overflow_extra3");
+            logger << "extra3\n";
+        }
+        logger << "Line1\n";
+        assert(logger.getTotalBuffer() == "Line1\n");
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+#endif
+}
+
+void batchCallbackTest() {
+    Logger logger(true);
+    logger.setAutoFlush(false);
+    LoggerTagHandle tag = LoggerTagRegistry::registerTag("batch_tag");
+    std::vector<std::vector<std::string>> batches;
+    std::vector<LoggerRecordInfo> infos;
+    logger.OnBatchWrite = [&](std::span<const std::string_view> records, std::span<const LoggerRecordInfo> record_infos) {
+        assert(records.size() == record_infos.size());
+        batches.push_back(std::vector<std::string>(records.begin(), records.end()));
+        infos.insert(infos.end(), record_infos.begin(), record_infos.end());
+    };
+    logger << "Line1\n";
+    {
+        LoggerTag tag_scope(logger, tag);
+        LoggerIndent indent(logger);
+        logger << "Line2\n";
+    }
+    logger << "\n";
+    assert(batches.empty());
+    logger.flush();
+    assert(batches.size() == 1);
+    assert(batches[0] == std::vector<std::string>({ "Line1\n", "|   Line2\n", "\n" }));
+    assert(infos[0].tag.id == LOGGER_BINARY_NO_TAG);
+    assert(infos[0].indent_level == 0);
+    assert(infos[1].tag.id == tag.id);
+    assert(infos[1].indent_level == 1);
+    assert(infos[0].time <= infos[1].time && infos[1].time <= infos[2].time);
+    logger.flush();
+    assert(batches.size() == 1);
+}
+
+void batchCallbackThreadsTest() {
+    const int thread_count = 4;
+    const int line_count = 100;
+    Logger logger(true);
+    logger.enableThreadSafe(64);
+    logger.setAutoFlush(false);
+    std::vector<LoggerRecordInfo> infos;
+    std::vector<std::string> records;
+    logger.OnBatchWrite = [&](std::span<const std::string_view> batch, std::span<const LoggerRecordInfo> batch_infos) {
+        records.insert(records.end(), batch.begin(), batch.end());
+        infos.insert(infos.end(), batch_infos.begin(), batch_infos.end());
+    };
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.push_back(std::thread([&, t]() {
+            for (int i = 0; i < line_count; i++) {
+                logger << t << "\n";
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    logger.flush();
+    assert(records.size() == thread_count * line_count);
+    // every thread has its own index, lines of a thread go in time order
+    std::vector<uint32_t> thread_index(thread_count, 0);
+    std::vector<int64_t> last_time(thread_count, 0);
+    for (size_t i = 0; i < records.size(); i++) {
+        int t = std::stoi(records[i]);
+        assert(infos[i].thread_index > 0);
+        if (thread_index[t] == 0) {
+            thread_index[t] = infos[i].thread_index;
+        }
+        assert(infos[i].thread_index == thread_index[t]);
+        assert(infos[i].time >= last_time[t]);
+        last_time[t] = infos[i].time;
+    }
+}
+
+std::string readFile(const std::filesystem::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream ss;
+    ss << file.rdbuf();
+    return ss.str();
+}
+
+void sinkFanOutTest() {
+    Logger logger(true);
+    std::ostringstream stream;
+    auto memory_sink = std::make_shared<LoggerMemorySink>();
+    logger.addSink(memory_sink);
+    logger.addSink(std::make_shared<LoggerStreamSink>(stream));
+    logger << "Line1\n";
+    logger << "Str1" << LoggerFlush();
+    logger << "Line2\n";
+    logger.flush();
+    // each record is written once even though test mode keeps total buffer
+    std::vector<std::string> records = memory_sink->getRecords();
+    assert(records == std::vector<std::string>({ "Line1\n", "Str1", "Line2\n" }));
+    assert(stream.str() == "Line1\nStr1Line2\n");
+    assert(logger.getTotalBuffer() == "Line1\nStr1Line2\n");
+}
+
+void sinkStagesTest() {
+    const int line_count = 100;
+    Logger logger(true);
+    auto slow_sink = std::make_shared<GatedSink>();
+    auto fast_sink = std::make_shared<GatedSink>();
+    fast_sink->open();
+    LoggerAsyncOptions options;
+    options.capacity = line_count;
+    logger.addSink(slow_sink, options);
+    logger.addSink(fast_sink, options);
+    std::vector<std::string> expected;
+    for (int i = 0; i < line_count; i++) {
+        logger << "Line" << i << "\n";
+        expected.push_back("Line" + std::to_string(i) + "\n");
+    }
+    // slow sink doesn't hold up the writer or the other sink
+    for (int i = 0; i < 5000 && fast_sink->getRecords().size() < line_count; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    assert(fast_sink->getRecords() == expected);
+    assert(slow_sink->getRecords().empty());
+    slow_sink->open();
+    logger.flush();
+    assert(slow_sink->getRecords() == expected);
+    // both sinks got the same copy
+    assert(slow_sink->getAddresses() == fast_sink->getAddresses());
+}
+
+void sinkStageDropTest() {
+    Logger logger(true);
+    auto slow_sink = std::make_shared<GatedSink>();
+    LoggerAsyncOptions options;
+    options.capacity = 2;
+    options.overflow_policy = LoggerOverflowPolicy::DropNewest;
+    logger.addSink(slow_sink, options);
+    for (int i = 0; i < 10; i++) {
+        logger << "Line" << i << "\n";
+    }
+    // one batch is being written, two are queued
+    assert(logger.getSinkDroppedCount(slow_sink) >= 7);
+    slow_sink->open();
+    logger.flush();
+    size_t written = slow_sink->getRecords().size();
+    assert(written + logger.getSinkDroppedCount(slow_sink) == 10);
+    assert(slow_sink->getRecords().front() == "Line0\n");
+}
+
+void memorySinkTest() {
+    Logger logger(true);
+    auto memory_sink = std::make_shared<LoggerMemorySink>(2);
+    logger.addSink(memory_sink);
+    logger << "Line1\nLine2\nLine3\n";
+    assert(memory_sink->getText() == "Line2\nLine3\n");
+}
+
+void fileSinkTest() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_file_sink_test.log";
+    std::filesystem::remove(path);
+    {
+        Logger logger(true);
+        auto file_sink = std::make_shared<LoggerFileSink>(path, 16);
+        assert(file_sink->isOpen());
+        logger.addSink(file_sink);
+        logger << "Line1\n";
+        // still in the buffer
+        assert(readFile(path) == "");
+        logger << "Line2\nLine3\n";
+        assert(readFile(path) == "Line1\nLine2\nLine3\n");
+        logger << "Line4\n";
+        logger.flush();
+        assert(readFile(path) == "Line1\nLine2\nLine3\nLine4\n");
+    }
+    std::filesystem::remove(path);
+}
+
+void rotatingFileSinkTest() {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "logger_rotating_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::filesystem::path path = dir / "app.log";
+    {
+        Logger logger(true);
+        logger.addSink(std::make_shared<LoggerRotatingFileSink>(path, 8, std::chrono::seconds(0), 2));
+        logger << "Line1\nLine2\nLine3\nLine4\n";
+    }
+    assert(readFile(path) == "Line4\n");
+    assert(readFile(dir / "app.log.1") == "Line3\n");
+    assert(readFile(dir / "app.log.2") == "Line2\n");
+    assert(!std::filesystem::exists(dir / "app.log.3"));
+    std::filesystem::remove_all(dir);
+}
+
+void mappedFileSinkTest() {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "logger_mapped_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::filesystem::path path = dir / "app.log";
+    {
+        Logger logger(true);
+        auto mapped_sink = std::make_shared<LoggerMappedFileSink>(path, 16);
+        assert(mapped_sink->isOpen());
+        logger.addSink(mapped_sink);
+        logger << "Line1\nLine2\nLine3\nLine4\n";
+        logger << "Long line that spans segments\n";
+    }
+    std::string text;
+    for (size_t i = 0; std::filesystem::exists(dir / ("app.log." + std::to_string(i))); i++) {
+        std::string segment = readFile(dir / ("app.log." + std::to_string(i)));
+        assert(segment.size() <= 16);
+        text += segment;
+    }
+    assert(text == "Line1\nLine2\nLine3\nLine4\nLong line that spans segments\n");
+    // last segment is truncated to its used length
+    assert(readFile(dir / "app.log.3") == "ments\n");
+    std::filesystem::remove_all(dir);
+}
+
+void mappedFileSinkCrashTest() {
+#ifndef _WIN32
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_mapped_crash_test.log";
+    std::filesystem::path segment_path = path;
+    segment_path += ".0";
+    std::filesystem::path next_segment_path = path;
+    next_segment_path += ".1";
+    std::filesystem::remove(segment_path);
+    std::filesystem::remove(next_segment_path);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        Logger logger(true);
+        logger.addSink(std::make_shared<LoggerMappedFileSink>(path, 4096));
+        logger << "Line1\nLine2\n";
+        // no destructors, no flush
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    std::string segment = readFile(segment_path);
+    assert(segment.size() == 4096);
+    assert(segment.substr(0, 12) == "Line1\nLine2\n");
+    assert(segment.find_first_not_of('\0', 12) == std::string::npos);
+    // restarted process starts a new segment and leaves the crashed one alone
+    {
+        Logger logger(true);
+        auto mapped_sink = std::make_shared<LoggerMappedFileSink>(path, 4096);
+        assert(mapped_sink->getSegmentPath(0) == next_segment_path);
+        logger.addSink(mapped_sink);
+        logger << "Line3\n";
+    }
+    assert(readFile(segment_path) == segment);
+    assert(readFile(next_segment_path) == "Line3\n");
+    std::filesystem::remove(segment_path);
+    std::filesystem::remove(next_segment_path);
+#endif
+}
+
+void latencyHistogramTest() {
+    for (uint64_t ns : { 0, 1, 7, 8, 15, 16, 17, 1000, 123456789 }) {
+        size_t index = LoggerLatencyHistogram::bucketIndex(ns);
+        assert(LoggerLatencyHistogram::bucketLowerBound(index) <= ns);
+        assert(LoggerLatencyHistogram::bucketLowerBound(index + 1) > ns);
+    }
+    assert(LoggerLatencyHistogram::bucketIndex(UINT64_MAX) == LoggerLatencyHistogram::BUCKET_COUNT - 1);
+    LoggerLatencyHistogram histogram;
+    assert(histogram.percentile(50) == 0);
+    for (int i = 0; i < 99; i++) {
+        histogram.add(100);
+    }
+    histogram.add(100000);
+    assert(histogram.getCount() == 100);
+    uint64_t p50 = histogram.percentile(50);
+    assert(p50 >= 100 && p50 < 100 * 1.125);
+    uint64_t p100 = histogram.percentile(100);
+    assert(p100 >= 100000 && p100 < 100000 * 1.125);
+}
+
+void statsTest() {
+    Logger logger(true);
+    LoggerTagHandle tag = LoggerTagRegistry::registerTag("stats_tag");
+    logger << "Line1\n";
+    logger << "Line2\n";
+    {
+        LoggerDisableTag disable_tag(logger, tag);
+        LoggerTag tag_scope(logger, tag);
+        // one line made of several writes is counted once
+        logger << "Hidden " << 1 << "\n";
+    }
+    logger.manualDeactivate();
+    logger << "Hidden\n";
+    logger.manualActivate();
+    {
+        LoggerDeactivate deactivate(logger);
+        logger << "Hidden\n";
+    }
+    LoggerStats stats = logger.getStats();
+#if LOGGER_STATS
+    assert(stats.lines == 2);
+    assert(stats.bytes == 12);
+    assert(stats.suppressed_tag == 1);
+    assert(stats.suppressed_manual == 1);
+    assert(stats.suppressed_switch == 1);
+    assert(stats.flushes >= 2);
+    assert(stats.flush_latency.getCount() == stats.flushes);
+#else
+    assert(stats.lines == 0 && stats.flushes == 0 && stats.flush_latency.getCount() == 0);
+#endif
+}
+
+void statsThreadsTest() {
+    const int thread_count = 4;
+    const int line_count = 100;
+    Logger logger(true);
+    logger.enableThreadSafe(64);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+        threads.push_back(std::thread([&]() {
+            for (int i = 0; i < line_count; i++) {
+                logger << "Line\n";
+            }
+        }));
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    logger.flush();
+#if LOGGER_STATS
+    assert(logger.getStats().lines == thread_count * line_count);
+#endif
+}
+
+void flightRecorderTest() {
+#if LOGGER_MIN_LEVEL <= LOGGER_LEVEL_DEBUG
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_flight_recorder_test.log";
+    Logger logger(true);
+    logger.setLevel(LoggerLevel::Info);
+    auto recorder = std::make_shared<LoggerFlightRecorder>(path, 32);
+    logger.setFlightRecorder(recorder, LoggerLevel::Debug);
+    int evaluated = 0;
+    LOGGER_TRACE(logger) << countedString(evaluated) << " trace\n";
+    assert(evaluated == 0);
+    LOGGER_DEBUG(logger) << "Debug1\n";
+    LOGGER_INFO(logger) << "Info1\n";
+    logger << "Line1\n";
+    logger.log(LoggerLevel::Debug, "Debug{}", 2);
+    // debug lines go only to the recorder
+    assert(logger.getTotalBuffer() == "Info1\nLine1\n");
+    assert(recorder->getText() == "Debug1\nInfo1\nLine1\nDebug2\n");
+    // partially overwritten oldest line is skipped
+    LOGGER_DEBUG(logger) << "Debug3\n";
+    assert(recorder->getText() == "Info1\nLine1\nDebug2\nDebug3\n");
+    recorder->write(std::string(100, 'x') + "\nEnd\n");
+    assert(recorder->getText() == "End\n");
+    assert(recorder->dump());
+    assert(readFile(path) == "End\n");
+    logger.setFlightRecorder(nullptr);
+    assert(!logger.isLevelEnabled(LoggerLevel::Debug));
+    std::filesystem::remove(path);
+#endif
+}
+
+void flightRecorderCrashTest() {
+#if !defined(_WIN32) && LOGGER_MIN_LEVEL <= LOGGER_LEVEL_TRACE
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_flight_recorder_crash_test.log";
+    std::filesystem::remove(path);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        Logger logger(true);
+        logger.setLevel(LoggerLevel::Off);
+        auto recorder = std::make_shared<LoggerFlightRecorder>(path);
+        recorder->installCrashHandler();
+        logger.setFlightRecorder(recorder);
+        LOGGER_TRACE(logger) << "Line1\n";
+        LOGGER_DEBUG(logger) << "Line2\n";
+        abort();
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+    assert(readFile(path) == "Line1\nLine2\n");
+    std::filesystem::remove(path);
+#endif
+}
+
+#ifndef _WIN32
+static void previousAbortHandler(int signal) {
+    _exit(3);
+}
+
+// each frame keeps its buffer alive, so the recursion can't be turned into a loop
+static size_t overflowStack(size_t depth) {
+    volatile char buffer[1024];
+    buffer[0] = (char)depth;
+    return overflowStack(depth + 1) + buffer[0];
+}
+#endif
+
+void flightRecorderSignalTest() {
+#ifndef _WIN32
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_flight_recorder_signal_test.log";
+    // handler installed before the recorder's runs after the dump
+    std::filesystem::remove(path);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        std::signal(SIGABRT, previousAbortHandler);
+        Logger logger(true);
+        auto recorder = std::make_shared<LoggerFlightRecorder>(path);
+        recorder->installCrashHandler();
+        logger.setFlightRecorder(recorder);
+        logger << "Line1\n";
+        abort();
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 3);
+    assert(readFile(path) == "Line1\n");
+    std::filesystem::remove(path);
+#endif
+}
+
+void flightRecorderStackOverflowTest() {
+    // sanitizer runtimes catch stack overflows themselves
+#if !defined(_WIN32) && !defined(__SANITIZE_THREAD__) && !defined(__SANITIZE_ADDRESS__)
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_flight_recorder_overflow_test.log";
+    // handler runs on its own stack, so a stack overflow is dumped too
+    std::filesystem::remove(path);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        Logger logger(true);
+        auto recorder = std::make_shared<LoggerFlightRecorder>(path);
+        recorder->installCrashHandler();
+        logger.setFlightRecorder(recorder);
+        logger << "Line1\n";
+        overflowStack(0);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+    assert(readFile(path) == "Line1\n");
+    std::filesystem::remove(path);
+#endif
+}
+
+void shmSinkTest() {
+#ifdef __linux__
+    std::string prefix = "logger_shm_test_" + std::to_string(getpid());
+    LoggerShmCollector collector(prefix);
+    std::ostringstream output;
+    std::string name;
+    {
+        Logger logger(true);
+        auto shm_sink = std::make_shared<LoggerShmSink>(prefix, 64);
+        assert(shm_sink->isOpen());
+        name = shm_sink->getName();
+        logger.addSink(shm_sink);
+        logger << "Line1\n";
+        assert(collector.collect(output, true) == 1);
+        assert(collector.getSegmentCount() == 1);
+        // ring is full, writes are dropped instead of waiting for the collector
+        for (int i = 0; i < 10; i++) {
+            logger << "Line" << i + 2 << "\n";
+        }
+        assert(shm_sink->getDroppedCount() > 0);
+        collector.collect(output, true);
+        logger << "Last\n";
+    }
+    // unread segment outlives the sink
+    collector.collect(output, true);
+    assert(collector.getSegmentCount() == 0);
+    std::vector<std::string> lines = splitLines(output.str());
+    assert(lines.front() == "Line1");
+    assert(lines.back() == "Last");
+    assert(output.str().find("dropped") != std::string::npos);
+    assert(!std::filesystem::exists("/dev/shm" + name));
+#endif
+}
+
+void shmLineTimeTest() {
+#ifdef __linux__
+    std::string prefix = "logger_shm_time_test_" + std::to_string(getpid());
+    LoggerShmCollector collector(prefix, std::chrono::microseconds(0));
+    std::ostringstream output;
+    {
+        Logger early_logger(true);
+        Logger late_logger(true);
+        early_logger.addSink(std::make_shared<LoggerShmSink>(prefix));
+        late_logger.addSink(std::make_shared<LoggerShmSink>(prefix));
+        early_logger.setAutoFlush(false);
+        early_logger << "Early\n";
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        late_logger << "Late\n";
+        // records keep the time of their line, not of the write
+        early_logger.flush();
+        collector.collect(output, true);
+    }
+    assert(output.str() == "Early\nLate\n");
+#endif
+}
+
+void shmSegmentNameTest() {
+#ifdef __linux__
+    std::string prefix = "logger_shm_name_test_" + std::to_string(getpid());
+    LoggerShmCollector collector(prefix);
+    std::ostringstream output;
+    {
+        Logger logger(true);
+        auto shm_sink1 = std::make_shared<LoggerShmSink>(prefix);
+        auto shm_sink2 = std::make_shared<LoggerShmSink>(prefix);
+        // segments of another prefix that starts the same way are not collected
+        auto other_sink = std::make_shared<LoggerShmSink>(prefix + ".worker");
+        assert(shm_sink1->getName() != shm_sink2->getName());
+        logger.addSink(shm_sink1);
+        logger.addSink(shm_sink2);
+        logger.addSink(other_sink);
+        logger << "Line1\n";
+        assert(collector.collect(output, true) == 2);
+        assert(collector.getSegmentCount() == 2);
+        LoggerShmCollector other_collector(prefix + ".worker");
+        assert(other_collector.collect(output, true) == 1);
+    }
+    collector.collect(output, true);
+    assert(output.str() == "Line1\nLine1\nLine1\n");
+#endif
+}
+
+void shmCollectorMergeTest() {
+#ifdef __linux__
+    const int process_count = 3;
+    const int line_count = 100;
+    std::string prefix = "logger_shm_merge_test_" + std::to_string(getpid());
+    std::vector<pid_t> pids;
+    for (int p = 0; p < process_count; p++) {
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            Logger logger(true);
+            logger.addSink(std::make_shared<LoggerShmSink>(prefix));
+            for (int i = 0; i < line_count; i++) {
+                logger << p << " " << i << "\n";
+            }
+            _exit(0);
+        }
+        pids.push_back(pid);
+    }
+    for (pid_t pid : pids) {
+        int status;
+        waitpid(pid, &status, 0);
+    }
+    // producers exited without closing their segments
+    LoggerShmCollector collector(prefix);
+    std::ostringstream output;
+    assert(collector.collect(output, true) == process_count * line_count);
+    assert(collector.getSegmentCount() == 0);
+    std::vector<std::string> lines = splitLines(output.str());
+    assert(lines.size() == process_count * line_count);
+    std::vector<int> next(process_count, 0);
+    for (const std::string& line : lines) {
+        int p, i;
+        std::stringstream ss(line);
+        ss >> p >> i;
+        assert(i == next[p]);
+        next[p]++;
+    }
+#endif
+}
+
+void blockCodecTest() {
+    std::vector<std::string> inputs = {
+        "",
+        "abc",
+        "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+        "|   |   |   [tag] Line 1\n|   |   |   [tag] Line 2\n|   |   |   [tag] Line 3\n",
+    };
+    std::string random_text;
+    unsigned int seed = 1;
+    for (int i = 0; i < 100000; i++) {
+        seed = seed * 1103515245 + 12345;
+        random_text += (char)(seed >> 16);
+    }
+    inputs.push_back(random_text);
+    std::string long_match(300, 'x');
+    inputs.push_back(random_text.substr(0, 1000) + long_match + random_text.substr(0, 1000));
+    LoggerBlockCodec codec;
+    for (const std::string& input : inputs) {
+        std::string compressed;
+        codec.compress(input, compressed);
+        std::string output(input.size(), '\0');
+        assert(LoggerBlockCodec::decompress(compressed, output.data(), output.size()));
+        assert(output == input);
+        if (!compressed.empty()) {
+            // corrupted data is rejected, not read past the end
+            std::string output2(input.size(), '\0');
+            LoggerBlockCodec::decompress(compressed.substr(0, compressed.size() - 1), output2.data(), output2.size());
+        }
+    }
+    std::string compressed;
+    codec.compress(inputs[2], compressed);
+    assert(compressed.size() < 10);
+}
+
+void compressedSinkTest() {
+    std::ostringstream stream;
+    auto compressed_sink = std::make_shared<LoggerCompressedSink>(std::make_shared<LoggerStreamSink>(stream), 1000);
+    Logger logger(true);
+    logger.addSink(compressed_sink);
+    for (int i = 0; i < 1000; i++) {
+        LoggerIndent indent(logger);
+        logger << "Repetitive line " << i % 10 << "\n";
+    }
+    logger.flush();
+    std::string text = logger.getTotalBuffer();
+    assert(compressed_sink->getRawSize() == text.size());
+    assert(compressed_sink->getCompressedSize() == stream.str().size());
+    assert(stream.str().size() < text.size() / 5);
+    std::istringstream input(stream.str());
+    std::ostringstream output;
+    LoggerDecompressor decompressor;
+    assert(decompressor.decompress(input, output));
+    assert(output.str() == text);
+    // truncated stream keeps the complete blocks
+    std::istringstream truncated(stream.str().substr(0, stream.str().size() - 1));
+    std::ostringstream partial;
+    assert(!decompressor.decompress(truncated, partial));
+    assert(partial.str().size() >= text.size() - 1000);
+    assert(text.starts_with(partial.str()));
+    // streams appended to each other
+    std::istringstream appended(stream.str() + stream.str());
+    std::ostringstream appended_output;
+    assert(decompressor.decompress(appended, appended_output));
+    assert(appended_output.str() == text + text);
+}
+
+void largeTextSpillTest() {
+    Logger logger(true);
+    auto memory_sink = std::make_shared<LoggerMemorySink>();
+    logger.addSink(memory_sink);
+    logger.setHighWaterMark(12);
+    {
+        LoggerLargeText large_text(logger);
+        logger << "Line1\n";
+        assert(memory_sink->getText() == "");
+        logger << "Line2\n";
+        // high-water mark reached
+        assert(memory_sink->getText() == "Line1\nLine2\n");
+        logger << "Line3\n";
+        assert(memory_sink->getText() == "Line1\nLine2\n");
+    }
+    assert(memory_sink->getText() == "Line1\nLine2\nLine3\n");
+    assert(logger.getTotalBuffer() == "Line1\nLine2\nLine3\n");
+}
+
+void largeTextFileTest() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "logger_large_text_test.log";
+    std::filesystem::remove(path);
+    {
+        Logger logger(true);
+        logger.addSink(std::make_shared<LoggerFileSink>(path, 0));
+        {
+            LoggerLargeText large_text(logger);
+            for (int i = 0; i < 5000; i++) {
+                logger << "Line " << i << "\n";
+                if (i % 1000 == 0) {
+                    // gets a page of its own
+                    logger << std::string(100000, 'x') << "\n";
+                }
+            }
+        }
+        assert(readFile(path) == logger.getTotalBuffer());
+    }
+    std::filesystem::remove(path);
+}
+
+void largeTextBoundedTest() {
+    Logger logger;
+    auto memory_sink = std::make_shared<LoggerMemorySink>(1);
+    logger.addSink(memory_sink);
+    logger.setHighWaterMark(64 * 1024);
+    size_t max_pages = 0;
+    {
+        LoggerLargeText large_text(logger);
+        for (int i = 0; i < 100000; i++) {
+            logger << "Line " << i << "\n";
+            max_pages = std::max(max_pages, logger.getTotalBufferPages());
+        }
+    }
+    assert(max_pages <= 2);
+    assert(logger.getTotalBufferPages() == 0);
+}
+
 void run_test(std::function<void()> func) {
     logger.lock();
     func();
@@ -275,6 +1963,7 @@ int main() {
     run_test(indent3Test);
     run_test(loggerFlushTest);
     run_test(onlineWriteTest);
+    run_test(onlineWriteThreadsTest);
     run_test(tagTest);
     run_test(deactivateTest);
     run_test(enableTagTest);
@@ -285,6 +1974,67 @@ int main() {
     run_test(disableAfterTagTest);
     run_test(reenableTag2Test);
     run_test(nestedTags2Test);
+    run_test(asyncWriteTest);
+    run_test(asyncBlockTest);
+    run_test(asyncDropNewestTest);
+    run_test(asyncDropOldestTest);
+    run_test(threadSafeOrderTest);
+    run_test(threadSafeScopesTest);
+    run_test(sinkChangeThreadsTest);
+    run_test(threadBatchOrderTest);
+    run_test(threadBatchIdleTest);
+    run_test(threadBatchMergeTest);
+    run_test(zeroAllocationTest);
+    run_test(timePrecisionTest);
+    run_test(monotonicClockTest);
+    run_test(timestampThreadsTest);
+    run_test(levelTest);
+    run_test(compileTimeLevelTest);
+    run_test(tagHandleTest);
+    run_test(tagScopeAllocationTest);
+    run_test(binaryRoundTripTest);
+    run_test(binaryTimeTest);
+    run_test(sinkFanOutTest);
+    run_test(sinkStagesTest);
+    run_test(sinkStageDropTest);
+    run_test(memorySinkTest);
+    run_test(fileSinkTest);
+    run_test(rotatingFileSinkTest);
+    run_test(mappedFileSinkTest);
+    run_test(mappedFileSinkCrashTest);
+    run_test(latencyHistogramTest);
+    run_test(statsTest);
+    run_test(statsThreadsTest);
+    run_test(flightRecorderTest);
+    run_test(flightRecorderCrashTest);
+    run_test(flightRecorderSignalTest);
+    run_test(flightRecorderStackOverflowTest);
+    run_test(shmSinkTest);
+    run_test(shmLineTimeTest);
+    run_test(shmSegmentNameTest);
+    run_test(shmCollectorMergeTest);
+    run_test(blockCodecTest);
+    run_test(compressedSinkTest);
+    run_test(largeTextSpillTest);
+    run_test(largeTextFileTest);
+    run_test(largeTextBoundedTest);
+    run_test(numberFormatTest);
+    run_test(binaryNumberFormatTest);
+    run_test(logTest);
+    run_test(logAllocationTest);
+    run_test(literalTest);
+    run_test(binaryLiteralTest);
+    run_test(literalAllocationTest);
+    run_test(indentStyleTest);
+    run_test(rateLimitTest);
+    run_test(lazyWriteTest);
+    run_test(enabledTagTest);
+    run_test(tagOverflowTest);
+    run_test(batchCallbackTest);
+    run_test(batchCallbackThreadsTest);
+    run_test(rateLimitSummaryTest);
+    run_test(rateLimitLoggersTest);
+    run_test(binaryIndentStyleTest);
     // Logger::enableStdWrite();
     std::cout << std::endl;
     std::cout << "ALL PASSED" << std::endl;